@@ -0,0 +1,319 @@
+#pragma once
+
+#ifndef ADAPTIVE_MARCHING_CUBES_H
+#define ADAPTIVE_MARCHING_CUBES_H
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+
+#include "ImplicitSurface.h"
+#include "MarchingCubes.h"
+#include "Parallel.h"
+
+struct AdaptiveMCOptions
+{
+	//! Every cell is subdivided down to minDepth, cells near the surface at most down to maxDepth (2^maxDepth cells per side,
+	//! as a uniform grid of this resolution).
+	unsigned int minDepth = 3;
+	unsigned int maxDepth = 7;
+
+	//! A cell near the surface is subdivided if the field deviates from the trilinear interpolation of its corner values by more
+	//! than tolerance times the cell diagonal (at the center and the face centers), i.e. where the surface is curved.
+	double tolerance = 2e-2;
+};
+
+//! Adaptive marching cubes on an octree that is built directly from an ImplicitSurface (no dense volume).
+//! The octree is refined level by level: a cell is subdivided if it may contain the surface (sign change of its samples or a
+//! sample closer to the iso value than half the cell diagonal, assuming a distance-like field) and the field is not trilinear
+//! in it. All samples of a level are evaluated in one parallel EvalBatch() pass, and are cached by their lattice position, since
+//! neighbouring cells share corners and face centers.
+//! The surface is extracted on the dual grid (dual marching cubes, Schaefer and Warren): every interior vertex of the octree
+//! defines a dual cell whose corners are the centers of the 8 leaves around it (leaves repeat where cells of different size
+//! meet). The dual cells tile the space without T-junctions, so marching cubes on them is crack-free. A vertex on a dual edge is
+//! identified by its two leaves and shared by all dual cells around the edge.
+class AdaptiveMarchingCubes
+{
+public:
+	AdaptiveMarchingCubes(const AdaptiveMCOptions& options = AdaptiveMCOptions()) : m_options(options)
+	{
+		m_options.maxDepth = std::min(m_options.maxDepth, +kMaxDepth);
+		m_options.minDepth = std::min(m_options.minDepth, m_options.maxDepth);
+	}
+
+	//! Extracts the iso-surface within the box [bbMin, bbMax] into mesh, returns the number of triangles.
+	size_t Extract(ImplicitSurface* surface, const Vector3d& bbMin, const Vector3d& bbMax, double iso, SimpleMesh* mesh)
+	{
+		m_bbMin = bbMin;
+		m_extent = bbMax - bbMin;
+		m_resolution = 1 << m_options.maxDepth;
+		m_nodes.clear();
+		m_samples.clear();
+
+		BuildOctree(surface, iso);
+		return ExtractDual(iso, mesh);
+	}
+
+	//! Number of Eval() calls (distinct sample positions) of the last extraction.
+	size_t GetNumEvals() const { return m_samples.size(); }
+
+	//! Number of leaves of the octree of the last extraction.
+	size_t GetNumLeaves() const
+	{
+		return std::count_if(m_nodes.begin(), m_nodes.end(), [](const Node& n) { return n.children < 0; });
+	}
+
+private:
+
+	//! 21 bits per doubled lattice coordinate.
+	static const unsigned int kMaxDepth = 19;
+
+	static const int kSamplesPerNode = 15;
+
+	//! Number of samples per task of the parallel evaluation.
+	static const size_t kEvalBlock = 256;
+
+	struct Node
+	{
+		//! Minimum corner on the lattice of the finest level and depth (size = 2^(maxDepth - depth) lattice cells).
+		Vector3i origin;
+		unsigned int depth;
+
+		//! Index of the first of the 8 children in m_nodes, -1 for a leaf.
+		int children;
+	};
+
+	//! Samples are addressed on the lattice of the finest level with doubled coordinates, so that the cell centers are integers.
+	static inline uint64_t GetKey(const Vector3i& c)
+	{
+		return (uint64_t)c.x() | ((uint64_t)c.y() << 21) | ((uint64_t)c.z() << 42);
+	}
+
+	inline Vector3d GetPosition(const Vector3i& doubled) const
+	{
+		return m_bbMin + (doubled.cast<double>() / (2.0 * m_resolution)).cwiseProduct(m_extent);
+	}
+
+	inline int GetSize(const Node& node) const
+	{
+		return 1 << (m_options.maxDepth - node.depth);
+	}
+
+	//! Doubled lattice coordinates of the samples of a node: 8 corners, the center and the 6 face centers.
+	void GetSamplePoints(const Node& node, Vector3i points[kSamplesPerNode]) const
+	{
+		const int s = 2 * GetSize(node), h = s / 2;
+		const Vector3i o = 2 * node.origin;
+		for (int corner = 0; corner < 8; ++corner)
+			points[corner] = o + s * Vector3i(corner & 1, (corner >> 1) & 1, corner >> 2);
+		points[8] = o + Vector3i(h, h, h);
+		for (int face = 0; face < 6; ++face)
+		{
+			Vector3i p(h, h, h);
+			p[face / 2] = (face & 1) ? s : 0;
+			points[9 + face] = o + p;
+		}
+	}
+
+	void BuildOctree(ImplicitSurface* surface, double iso)
+	{
+		m_nodes.push_back(Node{ Vector3i::Zero(), 0, -1 });
+
+		std::vector<int> level(1, 0);
+		while (!level.empty())
+		{
+			// evaluate the samples of the level that are not cached yet
+			std::vector<uint64_t> keys;
+			std::vector<Vector3i> points;
+			for (int n : level)
+			{
+				Vector3i nodePoints[kSamplesPerNode];
+				GetSamplePoints(m_nodes[n], nodePoints);
+				for (const Vector3i& p : nodePoints)
+				{
+					if (m_samples.emplace(GetKey(p), 0.0).second)
+					{
+						keys.push_back(GetKey(p));
+						points.push_back(p);
+					}
+				}
+			}
+			EvaluateSamples(surface, keys, points);
+
+			// subdivide
+			std::vector<int> nextLevel;
+			for (int n : level)
+			{
+				if (!ShouldRefine(m_nodes[n], iso)) continue;
+
+				const Node node = m_nodes[n];
+				const int h = GetSize(node) / 2;
+				m_nodes[n].children = (int)m_nodes.size();
+				for (int child = 0; child < 8; ++child)
+				{
+					nextLevel.push_back((int)m_nodes.size());
+					m_nodes.push_back(Node{ node.origin + h * Vector3i(child & 1, (child >> 1) & 1, child >> 2), node.depth + 1, -1 });
+				}
+			}
+			level.swap(nextLevel);
+		}
+	}
+
+	void EvaluateSamples(ImplicitSurface* surface, const std::vector<uint64_t>& keys, const std::vector<Vector3i>& points)
+	{
+		const size_t n = points.size();
+		std::vector<double> xs(n), ys(n), zs(n), values(n);
+		for (size_t i = 0; i < n; ++i)
+		{
+			const Vector3d p = GetPosition(points[i]);
+			xs[i] = p.x();
+			ys[i] = p.y();
+			zs[i] = p.z();
+		}
+
+		ParallelFor(0, (n + kEvalBlock - 1) / kEvalBlock, [&](size_t blk) {
+			const size_t first = blk * kEvalBlock;
+			surface->EvalBatch(&xs[first], &ys[first], &zs[first], &values[first], std::min<size_t>(+kEvalBlock, n - first));
+		});
+
+		for (size_t i = 0; i < n; ++i)
+			m_samples[keys[i]] = values[i];
+	}
+
+	bool ShouldRefine(const Node& node, double iso) const
+	{
+		if (node.depth < m_options.minDepth) return true;
+		if (node.depth >= m_options.maxDepth) return false;
+
+		Vector3i points[kSamplesPerNode];
+		GetSamplePoints(node, points);
+		double values[kSamplesPerNode];
+		for (int i = 0; i < kSamplesPerNode; ++i)
+			values[i] = m_samples.find(GetKey(points[i]))->second - iso;
+
+		// may the cell contain the surface?
+		const double diagonal = (m_extent / (double)(1 << node.depth)).norm();
+		bool below = false, above = false;
+		double minAbs = std::numeric_limits<double>::max();
+		for (double v : values)
+		{
+			below = below || v < 0.0;
+			above = above || v >= 0.0;
+			minAbs = std::min(minAbs, fabs(v));
+		}
+		if (!(below && above) && minAbs > 0.5 * diagonal) return false;
+
+		// deviation from the trilinear interpolation of the corners at the center and the face centers
+		const double center = 0.125 * (values[0] + values[1] + values[2] + values[3] + values[4] + values[5] + values[6] + values[7]);
+		double maxDeviation = fabs(values[8] - center);
+		for (int face = 0; face < 6; ++face)
+		{
+			// the 4 corners of the face
+			const int axis = face / 2, side = face & 1;
+			double faceMean = 0.0;
+			for (int corner = 0; corner < 8; ++corner)
+				if (((corner >> axis) & 1) == side) faceMean += 0.25 * values[corner];
+			maxDeviation = std::max(maxDeviation, fabs(values[9 + face] - faceMean));
+		}
+		return maxDeviation > m_options.tolerance * diagonal;
+	}
+
+	//! Leaf that contains the point given in doubled lattice coordinates (which must not lie on a cell boundary).
+	int FindLeaf(const Vector3i& doubled) const
+	{
+		int n = 0;
+		while (m_nodes[n].children >= 0)
+		{
+			const Node& node = m_nodes[n];
+			const Vector3i center = 2 * node.origin + Vector3i::Constant(GetSize(node));
+			n = node.children + (doubled.x() > center.x() ? 1 : 0) + (doubled.y() > center.y() ? 2 : 0) + (doubled.z() > center.z() ? 4 : 0);
+		}
+		return n;
+	}
+
+	size_t ExtractDual(double iso, SimpleMesh* mesh)
+	{
+		// interior vertices of the octree = corners of the leaves
+		std::vector<uint64_t> vertexKeys;
+		for (const Node& node : m_nodes)
+		{
+			if (node.children >= 0) continue;
+			const int s = GetSize(node);
+			for (int corner = 0; corner < 8; ++corner)
+			{
+				const Vector3i v = node.origin + s * Vector3i(corner & 1, (corner >> 1) & 1, corner >> 2);
+				if (v.minCoeff() > 0 && v.maxCoeff() < m_resolution) vertexKeys.push_back(GetKey(v));
+			}
+		}
+		std::sort(vertexKeys.begin(), vertexKeys.end());
+		vertexKeys.erase(std::unique(vertexKeys.begin(), vertexKeys.end()), vertexKeys.end());
+
+		// corners of a dual cell in the order of Polygonise(), as offsets (0: -, 1: +) from the octree vertex
+		static const int cornerOffsets[8][3] = { { 1, 0, 0 }, { 0, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 1 }, { 0, 0, 1 }, { 0, 1, 1 }, { 1, 1, 1 } };
+		static const int edgeCorners[12][2] = { { 0, 1 }, { 1, 2 }, { 2, 3 }, { 3, 0 }, { 4, 5 }, { 5, 6 }, { 6, 7 }, { 7, 4 }, { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 } };
+
+		const size_t numTriangles = mesh->GetTriangles().size();
+		std::unordered_map<uint64_t, unsigned int> edgeVertices;
+		const uint64_t mask = (1u << 21) - 1;
+		for (uint64_t key : vertexKeys)
+		{
+			const Vector3i v((int)(key & mask), (int)((key >> 21) & mask), (int)(key >> 42));
+
+			int leaves[8];
+			Vector3d positions[8];
+			double values[8];
+			int cubeindex = 0;
+			for (int corner = 0; corner < 8; ++corner)
+			{
+				const Vector3i offset(2 * cornerOffsets[corner][0] - 1, 2 * cornerOffsets[corner][1] - 1, 2 * cornerOffsets[corner][2] - 1);
+				leaves[corner] = FindLeaf(2 * v + offset);
+				const Node& leaf = m_nodes[leaves[corner]];
+				const Vector3i center = 2 * leaf.origin + Vector3i::Constant(GetSize(leaf));
+				positions[corner] = GetPosition(center);
+				values[corner] = m_samples.find(GetKey(center))->second;
+				if (values[corner] < iso) cubeindex |= 1 << corner;
+			}
+			if (edgeTable[cubeindex] == 0) continue;
+
+			const int8_t* tris = triTable[cubeindex];
+			for (int t = 0; tris[t] != -1; t += 3)
+			{
+				unsigned int idx[3];
+				for (int k = 0; k < 3; ++k)
+				{
+					const int a = edgeCorners[tris[t + k]][0], b = edgeCorners[tris[t + k]][1];
+					const uint64_t edgeKey = ((uint64_t)std::min(leaves[a], leaves[b]) << 32) | (uint64_t)std::max(leaves[a], leaves[b]);
+					auto it = edgeVertices.find(edgeKey);
+					if (it == edgeVertices.end())
+					{
+						// interpolate from the leaf with the smaller index, so that the vertex does not depend on the dual cell
+						const int first = leaves[a] < leaves[b] ? a : b, second = first == a ? b : a;
+						Vertex vertex = VertexInterp(iso, positions[first], positions[second], values[first], values[second]).cast<float>();
+						it = edgeVertices.emplace(edgeKey, mesh->AddVertex(vertex)).first;
+					}
+					idx[k] = it->second;
+				}
+
+				// dual cells with repeated leaves produce degenerate triangles
+				if (idx[0] != idx[1] && idx[1] != idx[2] && idx[0] != idx[2])
+					mesh->AddFace(idx[0], idx[1], idx[2]);
+			}
+		}
+
+		return mesh->GetTriangles().size() - numTriangles;
+	}
+
+	AdaptiveMCOptions m_options;
+
+	Vector3d m_bbMin, m_extent;
+	int m_resolution;
+
+	std::vector<Node> m_nodes;
+
+	//! Field values by doubled lattice position.
+	std::unordered_map<uint64_t, double> m_samples;
+};
+
+#endif // ADAPTIVE_MARCHING_CUBES_H
@@ -0,0 +1,181 @@
+#pragma once
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+
+//! 64 bit FNV-1a hash of a byte range. Pass the result of a previous call as seed to hash several ranges in sequence.
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 14695981039346656037ull)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	uint64_t hash = seed;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+//! Hashes the bytes of a trivially copyable value (no structs with padding).
+template<typename T>
+inline uint64_t HashValue(const T& value, uint64_t seed)
+{
+	return HashBytes(&value, sizeof(T), seed);
+}
+
+inline uint64_t HashString(const std::string& str, uint64_t seed)
+{
+	return HashBytes(str.data(), str.size(), HashValue(str.size(), seed));
+}
+
+//! Hashes the content of a file, returns 0 if it cannot be read.
+inline uint64_t HashFile(const std::string& filename)
+{
+	std::ifstream in(filename, std::ios::binary);
+	if (!in.is_open()) return 0;
+
+	uint64_t hash = HashBytes(nullptr, 0);
+	std::vector<char> buffer(1 << 20);
+	while (in)
+	{
+		in.read(buffer.data(), buffer.size());
+		hash = HashBytes(buffer.data(), (size_t)in.gcount(), hash);
+	}
+	return hash;
+}
+
+//! Directory of binary blobs that are identified by a kind (e.g. "volume") and a content hash of everything they depend on.
+//! A blob is a 64 byte header followed by the raw array, so the data is aligned and the file can be memory mapped and used in
+//! place. The files are in the byte order of the machine that wrote them; a blob with a different header is treated as a miss.
+class BlobCache
+{
+public:
+	explicit BlobCache(const std::string& directory = ".") : m_directory(directory) {}
+
+	std::string GetPath(const std::string& kind, uint64_t key) const
+	{
+		std::stringstream ss;
+		ss << m_directory << "/" << kind << "_" << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+		return ss.str();
+	}
+
+	//! Reads a blob of exactly count elements into data, returns false on a miss.
+	template<typename T>
+	bool Load(const std::string& kind, uint64_t key, T* data, size_t count) const
+	{
+		std::ifstream in;
+		if (!Open(in, kind, key, sizeof(T), count)) return false;
+		in.read((char*)data, count * sizeof(T));
+		return (size_t)in.gcount() == count * sizeof(T);
+	}
+
+	//! Reads a blob of any length, returns false on a miss.
+	template<typename T>
+	bool Load(const std::string& kind, uint64_t key, std::vector<T>& data) const
+	{
+		std::ifstream in;
+		size_t count = 0;
+		if (!Open(in, kind, key, sizeof(T), count, false)) return false;
+		data.resize(count);
+		in.read((char*)data.data(), count * sizeof(T));
+		return (size_t)in.gcount() == count * sizeof(T);
+	}
+
+	//! True if the blob exists and holds exactly count elements. Its payload starts at GetHeaderSize() and can be mapped in place.
+	template<typename T>
+	bool Contains(const std::string& kind, uint64_t key, size_t count) const
+	{
+		std::ifstream in;
+		return Open(in, kind, key, sizeof(T), count);
+	}
+
+	//! Writes the header of a blob whose payload was written in place, e.g. through a mapping of GetPath() (see MappedFile).
+	//! The blob is a miss until then, so a run that is aborted while writing the payload does not leave a valid blob behind.
+	template<typename T>
+	bool Commit(const std::string& kind, uint64_t key, size_t count) const
+	{
+		std::fstream out(GetPath(kind, key), std::ios::binary | std::ios::in | std::ios::out);
+		if (!out.is_open()) return false;
+
+		Header header = MakeHeader(key, sizeof(T), count);
+		out.write((const char*)&header, sizeof(Header));
+		return out.good();
+	}
+
+	//! Offset of the payload in a blob file.
+	static size_t GetHeaderSize() { return sizeof(Header); }
+
+	//! Writes a blob, returns false if the file cannot be written (the cache is an optimization, callers may ignore this).
+	template<typename T>
+	bool Store(const std::string& kind, uint64_t key, const T* data, size_t count) const
+	{
+		// write to a temporary file and rename it, so that concurrent or aborted runs never leave a truncated blob behind
+		const std::string path = GetPath(kind, key);
+		const std::string tmpPath = path + ".tmp";
+		{
+			std::ofstream out(tmpPath, std::ios::binary);
+			if (!out.is_open()) return false;
+
+			Header header = MakeHeader(key, sizeof(T), count);
+			out.write((const char*)&header, sizeof(Header));
+			out.write((const char*)data, count * sizeof(T));
+			if (!out.good()) return false;
+		}
+		std::remove(path.c_str());
+		return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+	}
+
+private:
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t elementSize;
+		uint64_t key;
+		uint64_t count;
+		uint64_t reserved[4];
+	};
+	static_assert(sizeof(Header) == 64, "the payload of a blob is 64 byte aligned");
+
+	static Header MakeHeader(uint64_t key, size_t elementSize, size_t count)
+	{
+		Header header;
+		memset(&header, 0, sizeof(Header));
+		memcpy(header.magic, "E2BLOB\0\0", 8);
+		header.version = 1;
+		header.elementSize = (uint32_t)elementSize;
+		header.key = key;
+		header.count = count;
+		return header;
+	}
+
+	//! Opens a blob and checks its header. If matchCount is false, count receives the number of elements.
+	bool Open(std::ifstream& in, const std::string& kind, uint64_t key, size_t elementSize, size_t& count, bool matchCount = true) const
+	{
+		in.open(GetPath(kind, key), std::ios::binary);
+		if (!in.is_open()) return false;
+
+		Header header;
+		in.read((char*)&header, sizeof(Header));
+		if (in.gcount() != sizeof(Header)) return false;
+
+		const Header expected = MakeHeader(key, elementSize, matchCount ? count : header.count);
+		if (memcmp(&header, &expected, sizeof(Header)) != 0) return false;
+		count = (size_t)header.count;
+		return true;
+	}
+
+	std::string m_directory;
+};
+
+#endif // CACHE_H
@@ -0,0 +1,196 @@
+#pragma once
+
+#ifndef COMPACT_RBF_H
+#define COMPACT_RBF_H
+
+#include <vector>
+
+#include "ImplicitSurface.h"
+#include "SpatialIndex.h"
+
+//! RBF reconstruction with compactly supported Wendland kernels  phi(r) = (1 - r/h)^4 (4 r/h + 1)  for r < h.
+//! Unlike the global r^3 kernels, symmetric bumps centered on the surface cannot represent a field that changes its sign across
+//! the surface, hence a kernel is placed at every function sample (on and off the surface). The Wendland kernel is positive
+//! definite, so no polynomial part is needed and the (regularized) interpolation system  (K + lambda^2 I) c = b  is solved
+//! directly instead of the normal equations, which would square the sparsity pattern.
+//! K only couples samples within the support radius h: it is assembled from the neighbour pairs of a spatial index into an
+//! Eigen::SparseMatrix and solved with a sparse LDL^T factorization (AMD fill-reducing ordering) or with CG and an incomplete
+//! Cholesky preconditioner. Evaluation only visits the centers within h of the query point.
+//! Far away from the samples the kernels vanish and the field does not carry the inside/outside information anymore.
+//! There it is blended smoothly into the signed distance to the tangent plane of the nearest input point (as in Hoppe).
+class CompactRBF : public ImplicitSurface
+{
+public:
+	CompactRBF(const std::string& filenamePC, double supportRadius, const RBFOptions& options = RBFOptions())
+		: m_supportRadius(supportRadius), m_options(options)
+	{
+		// load point cloud
+		PointCloud pointcloud;
+		pointcloud.ReadFromFile(filenamePC);
+		if (pointcloud.GetPoints().empty())
+		{
+			std::cerr << "CompactRBF: the point cloud is empty" << std::endl;
+			return;
+		}
+
+		// same function samples as the RBF: on surface points and off surface points along the normals
+		std::vector<Vector3d> points;
+		double eps = 0.01f;
+		for (unsigned int i = 0; i < pointcloud.GetPoints().size(); i++)
+		{
+			const Vector3d pt = pointcloud.GetPoints()[i].cast<double>();
+			points.push_back(pt);
+			m_normals.push_back(pointcloud.GetNormals()[i].cast<double>());
+			m_funcSamp.insertSample(pt, 0);
+		}
+		for (unsigned int i = 0; i < pointcloud.GetPoints().size(); i++)
+		{
+			m_funcSamp.insertSample(points[i] + m_normals[i] * eps, eps);
+			eps *= -1;
+		}
+		m_surfacePoints.Build(points, m_supportRadius);
+		m_numSurfacePoints = (unsigned int)points.size();
+
+		// the kernels cannot extrapolate the distance field beyond their support, so constrain it on both sides of the surface
+		// at half the support radius (only where the offset point is still closest to its own sample, i.e. not across thin parts)
+		const double offset = 0.5 * m_supportRadius;
+		for (unsigned int i = 0; i < points.size(); i++)
+		{
+			for (int side = -1; side <= 1; side += 2)
+			{
+				const Vector3d pt = points[i] + side * offset * m_normals[i];
+				if (m_surfacePoints.Nearest(pt) == (int)i)
+					m_funcSamp.insertSample(pt, side * offset);
+			}
+		}
+
+		m_numCenters = (unsigned int)m_funcSamp.m_pos.size();
+		m_centers.Build(m_funcSamp.m_pos, m_supportRadius);
+
+		BuildSystem();
+		SolveSystem();
+	}
+
+	double Eval(const Eigen::Vector3d& _x)
+	{
+		if (m_numCenters == 0) return 0.0;
+
+		// the surface points are the first centers, so the nearest one within the support radius is found on the way
+		double result = 0.0;
+		double minDist2 = std::numeric_limits<double>::max();
+		int idx = -1;
+		m_centers.ForEachInRadius(_x, m_supportRadius, [&](unsigned int j, double d2) {
+			result += m_coefficents[j] * EvalBasis(sqrt(d2));
+			if (j < m_numSurfacePoints && d2 < minDist2)
+			{
+				minDist2 = d2;
+				idx = (int)j;
+			}
+		});
+
+		const double halfSupport = 0.5 * m_supportRadius;
+		if (minDist2 <= halfSupport * halfSupport)
+			return result;
+
+		// blend into the tangent plane distance of the nearest surface point, the weight vanishes at half the support radius
+		if (idx < 0) idx = m_surfacePoints.Nearest(_x, &minDist2);
+		const double planeDist = (_x - m_surfacePoints.GetPoints()[idx]).dot(m_normals[idx]);
+		const double t = std::min(1.0, (sqrt(minDist2) - halfSupport) / halfSupport);
+		const double w = t * t * (3.0 - 2.0 * t);
+		return (1.0 - w) * result + w * planeDist;
+	}
+
+	//! Number of non-zeros of the system matrix.
+	Eigen::Index GetNumNonZeros() const { return m_numNonZeros; }
+
+private:
+
+	double EvalBasis(double r) const
+	{
+		const double q = r / m_supportRadius;
+		if (q >= 1.0) return 0.0;
+		const double a = 1.0 - q;
+		return a * a * a * a * (4.0 * q + 1.0);
+	}
+
+	//! Assembles the sparse kernel matrix K + lambda^2 I.
+	void BuildSystem()
+	{
+		std::vector<Eigen::Triplet<double>> triplets;
+		for (unsigned int i = 0; i < m_numCenters; ++i)
+		{
+			m_centers.ForEachInRadius(m_funcSamp.m_pos[i], m_supportRadius, [&](unsigned int j, double d2) {
+				triplets.push_back(Eigen::Triplet<double>(i, j, EvalBasis(sqrt(d2)) + (i == j ? m_lambda * m_lambda : 0.0)));
+			});
+		}
+
+		m_systemMatrix.resize(m_numCenters, m_numCenters);
+		m_systemMatrix.setFromTriplets(triplets.begin(), triplets.end());
+		m_rhs = Eigen::Map<const VectorXd>(m_funcSamp.m_val.data(), m_numCenters);
+		m_numNonZeros = m_systemMatrix.nonZeros();
+	}
+
+	void SolveSystem()
+	{
+		if (m_options.verbose) std::cerr << "Solving sparse RBF System (" << m_systemMatrix.nonZeros() << " non-zeros)" << std::endl;
+
+		bool solved = false;
+		if (m_options.solver != RBFSolverType::ConjugateGradient)
+		{
+			Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> ldlt(m_systemMatrix);
+			solved = ldlt.info() == Eigen::Success;
+			if (solved)
+				m_coefficents = ldlt.solve(m_rhs);
+			else if (m_options.verbose)
+				std::cerr << "Sparse LDLT failed, falling back to CG" << std::endl;
+		}
+		if (!solved)
+		{
+			Eigen::ConjugateGradient<Eigen::SparseMatrix<double>, Eigen::Lower | Eigen::Upper, Eigen::IncompleteCholesky<double>> cg;
+			cg.setTolerance(m_options.cgTolerance);
+			cg.setMaxIterations(m_options.cgMaxIterations);
+			cg.compute(m_systemMatrix);
+			m_coefficents = cg.solve(m_rhs);
+			if (cg.info() != Eigen::Success)
+				std::cerr << "CompactRBF: CG did not converge (error " << cg.error() << ")" << std::endl;
+			else if (m_options.verbose)
+				std::cerr << "CG: " << cg.iterations() << " iterations, error " << cg.error() << std::endl;
+		}
+
+		// not needed anymore
+		m_systemMatrix = Eigen::SparseMatrix<double>();
+
+		if (m_options.verbose) std::cerr << "Done." << std::endl;
+	}
+
+	//! Support radius h of the kernels.
+	double m_supportRadius;
+
+	RBFOptions m_options;
+
+	//! Weight of the regularizer.
+	double m_lambda = 0.0001;
+
+	//! The function samples, each of them is the center of a kernel.
+	FunctionSamples m_funcSamp;
+	unsigned int m_numCenters = 0;
+
+	//! The first m_numSurfacePoints centers are the input points.
+	unsigned int m_numSurfacePoints = 0;
+
+	//! Spatial index over the centers.
+	PointGrid m_centers;
+
+	//! Spatial index over the input points and their normals.
+	PointGrid m_surfacePoints;
+	std::vector<Vector3d> m_normals;
+
+	Eigen::SparseMatrix<double> m_systemMatrix;
+	Eigen::Index m_numNonZeros = 0;
+	VectorXd m_rhs;
+
+	//! kernel weights
+	VectorXd m_coefficents;
+};
+
+#endif // COMPACT_RBF_H
@@ -0,0 +1,127 @@
+#pragma once
+
+#ifndef IMLS_H
+#define IMLS_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "ImplicitSurface.h"
+#include "SpatialIndex.h"
+
+//! Implicit moving least squares surface (Kolluri, "Provably good moving least squares").
+//! f(x) = sum_i w_i(x) (x - p_i) . n_i / sum_i w_i(x)  with Gaussian weights  w_i(x) = exp(-|x - p_i|^2 / h^2),
+//! i.e. a smooth blend of the tangent plane distances of all input points near x instead of the single nearest one (Hoppe).
+//! The Gaussians are truncated at the radius 3h (and shifted, so that they vanish continuously there), hence only the points
+//! within this radius are visited via a spatial index and there is no global system: the cost of an evaluation only depends on
+//! the local point density, not on the size of the cloud. Where no point is within 3h, the tangent plane of the nearest point is used;
+//! it is looked up in a kd-tree, since the rings of the grid would visit many empty cells far from the surface.
+class IMLS : public ImplicitSurface
+{
+public:
+	//! The bandwidth h should be one to two times the point spacing: smaller values give Hoppe-like facets, larger ones smooth out details.
+	IMLS(const std::string& filenamePC, double bandwidth) : m_bandwidth(bandwidth), m_radius(kSupport * bandwidth)
+	{
+		// load point cloud
+		PointCloud pointcloud;
+		pointcloud.ReadFromFile(filenamePC);
+
+		std::vector<Vector3d> points;
+		for (unsigned int i = 0; i < pointcloud.GetPoints().size(); i++)
+		{
+			points.push_back(pointcloud.GetPoints()[i].cast<double>());
+			m_normals.push_back(pointcloud.GetNormals()[i].cast<double>());
+		}
+		m_points.Build(points, m_radius);
+		m_farField.Build(points);
+
+		m_invBandwidth2 = 1.0 / (m_bandwidth * m_bandwidth);
+		m_cutoff = exp(-kSupport * kSupport);
+	}
+
+	double Eval(const Eigen::Vector3d& _x)
+	{
+		double sumWeights = 0.0, result = 0.0;
+		m_points.ForEachInRadius(_x, m_radius, [&](unsigned int i, double d2) {
+			const double w = std::max(0.0, exp(-d2 * m_invBandwidth2) - m_cutoff);
+			sumWeights += w;
+			result += w * (_x - m_points.GetPoints()[i]).dot(m_normals[i]);
+		});
+		if (sumWeights > 0.0)
+			return result / sumWeights;
+
+		return EvalNearestPlane(_x);
+	}
+
+	//! Queries are processed in tiles of consecutive points (e.g. a row of the volume): the neighbours of a tile are gathered once
+	//! into SoA arrays, and all queries of the tile are evaluated against them with vectorized array expressions.
+	void EvalBatch(const double* xs, const double* ys, const double* zs, double* out, size_t n)
+	{
+		std::vector<double> px, py, pz, nx, ny, nz;
+		for (size_t first = 0, count = 0; first < n; first += count)
+		{
+			// extend the tile while its extent stays below the support radius, so that few of the gathered points are wasted
+			Vector3d bbMin(xs[first], ys[first], zs[first]), bbMax = bbMin;
+			for (count = 1; count < kQueryTile && first + count < n; ++count)
+			{
+				const Vector3d x(xs[first + count], ys[first + count], zs[first + count]);
+				if ((bbMax.cwiseMax(x) - bbMin.cwiseMin(x)).norm() > m_radius) break;
+				bbMin = bbMin.cwiseMin(x);
+				bbMax = bbMax.cwiseMax(x);
+			}
+
+			// all points within the support of a query of the tile
+			px.clear(); py.clear(); pz.clear();
+			nx.clear(); ny.clear(); nz.clear();
+			m_points.ForEachInRadius(0.5 * (bbMin + bbMax), 0.5 * (bbMax - bbMin).norm() + m_radius, [&](unsigned int i, double) {
+				const Vector3d& p = m_points.GetPoints()[i];
+				px.push_back(p.x()); py.push_back(p.y()); pz.push_back(p.z());
+				nx.push_back(m_normals[i].x()); ny.push_back(m_normals[i].y()); nz.push_back(m_normals[i].z());
+			});
+
+			const Eigen::Index m = (Eigen::Index)px.size();
+			const Eigen::Map<const Eigen::ArrayXd> PX(px.data(), m), PY(py.data(), m), PZ(pz.data(), m);
+			const Eigen::Map<const Eigen::ArrayXd> NX(nx.data(), m), NY(ny.data(), m), NZ(nz.data(), m);
+			for (size_t q = first; q < first + count; ++q)
+			{
+				const Eigen::ArrayXd dx = xs[q] - PX, dy = ys[q] - PY, dz = zs[q] - PZ;
+				const Eigen::ArrayXd w = ((-(dx.square() + dy.square() + dz.square()) * m_invBandwidth2).exp() - m_cutoff).max(0.0);
+				const double sumWeights = w.sum();
+				if (sumWeights > 0.0)
+					out[q] = (w * (dx * NX + dy * NY + dz * NZ)).sum() / sumWeights;
+				else
+					out[q] = EvalNearestPlane(Vector3d(xs[q], ys[q], zs[q]));
+			}
+		}
+	}
+
+private:
+
+	//! Signed distance to the tangent plane of the nearest input point (as in Hoppe). The exact nearest point keeps the field
+	//! continuous and its sign consistent with the input, also on thin or concave parts where the normals of nearby points differ.
+	double EvalNearestPlane(const Vector3d& x) const
+	{
+		const int idx = m_farField.Nearest(x);
+		if (idx < 0) return 0.0;
+		return (x - m_points.GetPoints()[idx]).dot(m_normals[idx]);
+	}
+
+	//! Truncation radius of the Gaussians in units of the bandwidth.
+	static constexpr double kSupport = 3.0;
+
+	//! Number of queries per tile of EvalBatch().
+	static const size_t kQueryTile = 8;
+
+	double m_bandwidth, m_radius;
+	double m_invBandwidth2, m_cutoff;
+
+	//! Spatial index over the input points (cell size = truncation radius) and their normals.
+	PointGrid m_points;
+	std::vector<Vector3d> m_normals;
+
+	//! kd-tree over the same points, for the nearest point far from the surface.
+	PointTree m_farField;
+};
+
+#endif // IMLS_H
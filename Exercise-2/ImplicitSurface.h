@@ -3,17 +3,34 @@
 #ifndef IMPLICIT_SURFACE_H
 #define IMPLICIT_SURFACE_H
 
+#include <memory>
+#include <random>
+#include <algorithm>
+
 #include "Eigen.h"
 #include "SimpleMesh.h"
+#include "RBFSolver.h"
+#include "RBFTreecode.h"
+#include "Cache.h"
 
 class ImplicitSurface
 {
 public:
+	virtual ~ImplicitSurface() {}
+
 	virtual double Eval(const Eigen::Vector3d& x) = 0;
+
+	//! Evaluates the surface at n points given as separate x, y and z arrays (SoA) and writes the values to out.
+	//! Subclasses override this with a vectorized version; the default falls back to one Eval() call per point.
+	virtual void EvalBatch(const double* xs, const double* ys, const double* zs, double* out, size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+			out[i] = Eval(Eigen::Vector3d(xs[i], ys[i], zs[i]));
+	}
 };
 
 
-class Sphere : public ImplicitSurface
+class Sphere final : public ImplicitSurface
 {
 public:
 	Sphere(const Eigen::Vector3d& center, double radius) : m_center(center), m_radius(radius)
@@ -27,13 +44,19 @@ public:
 		return (_x - m_center).squaredNorm() - m_radius * m_radius;
 	}
 
+	void EvalBatch(const double* xs, const double* ys, const double* zs, double* out, size_t n)
+	{
+		const Eigen::Map<const Eigen::ArrayXd> x(xs, n), y(ys, n), z(zs, n);
+		Eigen::Map<Eigen::ArrayXd>(out, n) = (x - m_center.x()).square() + (y - m_center.y()).square() + (z - m_center.z()).square() - m_radius * m_radius;
+	}
+
 private:
 	Eigen::Vector3d m_center;
 	double m_radius;
 };
 
 
-class Torus : public ImplicitSurface
+class Torus final : public ImplicitSurface
 {
 public:
 	Torus(const Eigen::Vector3d& center, double radius, double a) : m_center(center), m_radius(radius), m_a(a)
@@ -48,6 +71,13 @@ public:
     	return q*q + p[2]*p[2] - m_a * m_a;
 	}
 
+	void EvalBatch(const double* xs, const double* ys, const double* zs, double* out, size_t n)
+	{
+		const Eigen::Map<const Eigen::ArrayXd> x(xs, n), y(ys, n), z(zs, n);
+		const Eigen::ArrayXd q = ((x - m_center.x()).square() + (y - m_center.y()).square()).sqrt() - m_radius;
+		Eigen::Map<Eigen::ArrayXd>(out, n) = q.square() + (z - m_center.z()).square() - m_a * m_a;
+	}
+
 private:
 	Eigen::Vector3d m_center;
 	double m_radius;
@@ -225,49 +255,95 @@ private:
 
 #else
 
+//! Parameters of the RBF reconstruction.
+struct RBFOptions
+{
+	//! Solver for the normal equations (Auto picks one by problem size, see SelectSolver()).
+	RBFSolverType solver = RBFSolverType::Auto;
+
+	//! Relative residual and iteration limit of the conjugate gradient solver.
+	double cgTolerance = 1e-8;
+	int cgMaxIterations = 2000;
+
+	//! Print the progress of the solve to std::cerr.
+	bool verbose = true;
+
+	//! Greedy center selection (see RBF::FitGreedy()): only a subset of the points become centers, points are added until the
+	//! residuals at all function samples are below greedyTolerance.
+	bool greedyCenters = false;
+	double greedyTolerance = 1e-3;
+	unsigned int greedyInitialCenters = 64;
+	unsigned int greedyCentersPerIteration = 32;
+
+	//! Keep the Cholesky factor of the normal equations after a dense solve (or the greedy selection), so that RBF::AppendSamples()
+	//! can extend it. Costs a second (n + 4)^2 matrix during the factorization and keeps the factor in memory.
+	bool keepFactorization = false;
+
+	//! Choose the regularization weight lambda automatically by generalized cross-validation over a logarithmic sweep of
+	//! numLambdas values in [lambdaMin, lambdaMax] (see RBF::SolveRegularizationPath()). This needs the dense system: with the
+	//! matrix-free ConjugateGradient solver, which Auto picks for large fits (see SelectSolver()), the fixed lambda is used and a
+	//! warning is printed.
+	bool selectLambda = false;
+	double lambdaMin = 1e-8;
+	double lambdaMax = 1e-1;
+	unsigned int numLambdas = 36;
+
+	//! Directory of the coefficient cache (empty: disabled). A fit whose points, normals and options hash to a cached blob
+	//! loads its centers and coefficients from there instead of solving again (see RBF::LoadCoefficients()).
+	std::string cacheDirectory;
+};
+
+//! Hash of the options that change the solution of a fit (not verbose, keepFactorization and cacheDirectory).
+inline uint64_t HashRBFOptions(const RBFOptions& options, uint64_t key)
+{
+	key = HashValue(options.solver, key);
+	key = HashValue(options.cgTolerance, key);
+	key = HashValue(options.cgMaxIterations, key);
+	key = HashValue(options.greedyCenters, key);
+	if (options.greedyCenters)
+	{
+		key = HashValue(options.greedyTolerance, key);
+		key = HashValue(options.greedyInitialCenters, key);
+		key = HashValue(options.greedyCentersPerIteration, key);
+	}
+	key = HashValue(options.selectLambda, key);
+	if (options.selectLambda)
+	{
+		key = HashValue(options.lambdaMin, key);
+		key = HashValue(options.lambdaMax, key);
+		key = HashValue(options.numLambdas, key);
+	}
+	return key;
+}
+
 class RBF : public ImplicitSurface
 {
 public:
-	RBF(const std::string& filenamePC)
+	//! A positive approximationTolerance switches to the approximate evaluation after the fit (see SetApproximationTolerance()).
+	RBF(const std::string& filenamePC, const RBFOptions& options = RBFOptions(), double approximationTolerance = 0.0) : m_options(options)
 	{
 		// load point cloud
-		m_pointcloud.ReadFromFile(filenamePC);
-
-		// Create function samples
-		double eps = 0.01f;
-
-		// on surface points (-> center points of the RBFs)
-		for (unsigned int i = 0; i < m_pointcloud.GetPoints().size(); i++)
-		{
-			Eigen::Vector3f ptF = m_pointcloud.GetPoints()[i];
-			Eigen::Vector3f nF = m_pointcloud.GetNormals()[i];
-			const Vector3d pt(ptF[0], ptF[1], ptF[2]);
-			const Vector3d n(nF[0], nF[1], nF[2]);
-
-			m_funcSamp.insertSample(pt, 0); // on surface point => distance = 0
-		}
+		PointCloud pointcloud;
+		pointcloud.ReadFromFile(filenamePC);
 
-		// off surface points
-		for (unsigned int i = 0; i < m_pointcloud.GetPoints().size(); i++)
+		std::vector<Vector3d> points, normals;
+		points.reserve(pointcloud.GetPoints().size());
+		normals.reserve(pointcloud.GetPoints().size());
+		for (unsigned int i = 0; i < pointcloud.GetPoints().size(); i++)
 		{
-			Eigen::Vector3f ptF = m_pointcloud.GetPoints()[i];
-			Eigen::Vector3f nF = m_pointcloud.GetNormals()[i];
-			const Vector3d pt(ptF[0], ptF[1], ptF[2]);
-			const Vector3d n(nF[0], nF[1], nF[2]);
-
-			m_funcSamp.insertSample(pt + n*eps, eps);// off surface point => distance = eps
-			eps *= -1;
+			points.push_back(pointcloud.GetPoints()[i].cast<double>());
+			normals.push_back(pointcloud.GetNormals()[i].cast<double>());
 		}
 
-		m_numCenters = (unsigned int) m_pointcloud.GetPoints().size();
-		const unsigned int dim = m_numCenters + 4;
+		Fit(points, normals);
+		if (approximationTolerance > 0.0)
+			SetApproximationTolerance(approximationTolerance);
+	}
 
-		// build and solve the linear system of equations
-		m_systemMatrix = MatrixXd(dim, dim);
-		m_rhs = VectorXd(dim);
-		m_coefficents = VectorXd(dim); // result of the linear system
-		BuildSystem();
-		SolveSystem();
+	//! Fits the RBF to oriented points that are already in memory (e.g. a part of a larger point cloud).
+	RBF(const std::vector<Vector3d>& points, const std::vector<Vector3d>& normals, const RBFOptions& options = RBFOptions()) : m_options(options)
+	{
+		Fit(points, normals);
 	}
 
 	double Eval(const Eigen::Vector3d& _x)
@@ -277,11 +353,17 @@ public:
 		// the following parameters are the coeffients for the linear and the constant part
 		// the centers of the RBFs are the first m_numCenters sample points (use m_funcSamp.m_pos[i] to access them)
 		// hint: Eigen provides a norm() function to compute the l2-norm of a vector (e.g. see macro phi(i,j))
-		double result = 0.0;
 
-		for (unsigned int i = 0; i < m_numCenters; ++i){
-			double r = (_x - m_funcSamp.m_pos[i]).norm();
-			result += m_coefficents[i] * EvalBasis(r);
+		double result = 0.0;
+		if (m_treecode)
+		{
+			result = m_treecode->Eval(_x);
+		}
+		else
+		{
+			// single query: vectorize over the packed centers instead
+			const Eigen::ArrayXd r2 = (m_centerX - _x.x()).square() + (m_centerY - _x.y()).square() + (m_centerZ - _x.z()).square();
+			result = (m_centerWeight * r2.sqrt().cube()).sum();
 		}
 
 		result += m_coefficents[m_numCenters + 0] * _x.x();
@@ -292,8 +374,409 @@ public:
 		return result;
 	}
 
+	void EvalBatch(const double* xs, const double* ys, const double* zs, double* out, size_t n)
+	{
+		const Eigen::Map<const Eigen::ArrayXd> x(xs, n), y(ys, n), z(zs, n);
+		Eigen::Map<Eigen::ArrayXd> result(out, n);
+
+		result = m_coefficents[m_numCenters + 0] * x + m_coefficents[m_numCenters + 1] * y + m_coefficents[m_numCenters + 2] * z + m_coefficents[m_numCenters + 3];
+
+		if (m_treecode)
+		{
+			for (size_t i = 0; i < n; ++i)
+				out[i] += m_treecode->Eval(Eigen::Vector3d(xs[i], ys[i], zs[i]));
+			return;
+		}
+
+		// cache blocking: a tile of centers stays in L1 while it is applied to all tiles of query points,
+		// the innermost loop runs over the query points of a tile (vectorized by Eigen, AVX2/AVX-512 when enabled)
+		const Eigen::Index numCenters = m_numCenters;
+		const Eigen::Index numPoints = (Eigen::Index)n;
+		for (Eigen::Index c0 = 0; c0 < numCenters; c0 += kCenterTile)
+		{
+			const Eigen::Index c1 = std::min<Eigen::Index>(c0 + kCenterTile, numCenters);
+
+			for (Eigen::Index q0 = 0; q0 < numPoints; q0 += kQueryTile)
+			{
+				const Eigen::Index nq = std::min<Eigen::Index>(numPoints - q0, +kQueryTile);
+				const auto qx = x.segment(q0, nq);
+				const auto qy = y.segment(q0, nq);
+				const auto qz = z.segment(q0, nq);
+
+				Eigen::Array<double, Eigen::Dynamic, 1, 0, kQueryTile, 1> acc = result.segment(q0, nq);
+				for (Eigen::Index c = c0; c < c1; ++c)
+					acc += m_centerWeight[c] * ((qx - m_centerX[c]).square() + (qy - m_centerY[c]).square() + (qz - m_centerZ[c]).square()).sqrt().cube();
+				result.segment(q0, nq) = acc;
+			}
+		}
+	}
+
+	//! Switches to approximate evaluation: far away clusters of centers are replaced by their multipole (Taylor) expansion,
+	//! such that the absolute error of Eval() is at most 'tolerance' (see RBFTreecode). A tolerance <= 0 restores the exact evaluation.
+	void SetApproximationTolerance(double tolerance)
+	{
+		m_approximationTolerance = tolerance;
+		if (tolerance > 0.0)
+			m_treecode.reset(new RBFTreecode(m_centerX, m_centerY, m_centerZ, m_centerWeight, tolerance));
+		else
+			m_treecode.reset();
+	}
+
+	//! Weight of the regularizer that was used for the fit.
+	double GetLambda() const { return m_lambda; }
+
+	//! Adds oriented points to the fit and updates the coefficients, the new points become centers as well.
+	//! If the factorization was kept (RBFOptions::keepFactorization), the Cholesky factor is extended by the new rows and columns,
+	//! which costs O(n^2 k) for k new points instead of O(n^3) for a refit. Otherwise, the matrix-free conjugate gradient solver is
+	//! warm-started from the previous coefficients, or the dense system is rebuilt and factorized again.
+	//! Returns false and leaves the fit unchanged if there is not exactly one normal per point.
+	bool AppendSamples(const std::vector<Vector3d>& points, const std::vector<Vector3d>& normals)
+	{
+		if (points.size() != normals.size())
+		{
+			if (m_options.verbose) std::cerr << "AppendSamples: " << points.size() << " points, but " << normals.size() << " normals" << std::endl;
+			return false;
+		}
+		if (points.empty()) return true;
+
+		FunctionSamples newSamples;
+		for (unsigned int i = 0; i < points.size(); i++)
+		{
+			newSamples.insertSample(points[i], 0);
+			newSamples.insertSample(points[i] + normals[i] * m_offset, m_offset);
+			m_offset *= -1;
+		}
+
+		if (!m_factor || !AddCenters(newSamples))
+		{
+			m_factor.reset();
+
+			const unsigned int numOld = m_numCenters;
+			const unsigned int numNew = (unsigned int)points.size();
+			for (unsigned int i = 0; i < newSamples.m_pos.size(); i++)
+			{
+				if (i % 2 == 0) m_centerIndex.push_back((unsigned int)m_funcSamp.m_pos.size());
+				m_funcSamp.insertSample(newSamples.m_pos[i], newSamples.m_val[i]);
+			}
+			m_numCenters = numOld + numNew;
+			PackCenters();
+
+			// initial guess for CG: the previous coefficients, zero for the new kernels
+			VectorXd x(m_numCenters + 4);
+			x << m_coefficents.head(numOld), VectorXd::Zero(numNew), m_coefficents.tail(4);
+			m_coefficents = x;
+			SolveCoefficients();
+		}
+
+		if (m_treecode)
+			SetApproximationTolerance(m_approximationTolerance);
+		return true;
+	}
+
 private:
 
+	//! Creates the function samples for the oriented points and solves for the coefficients.
+	void Fit(const std::vector<Vector3d>& points, const std::vector<Vector3d>& normals)
+	{
+		// Create function samples
+		double& eps = m_offset;
+
+		// on surface points (-> center points of the RBFs)
+		for (unsigned int i = 0; i < points.size(); i++)
+		{
+			m_funcSamp.insertSample(points[i], 0); // on surface point => distance = 0
+		}
+
+		// off surface points
+		for (unsigned int i = 0; i < points.size(); i++)
+		{
+			m_funcSamp.insertSample(points[i] + normals[i]*eps, eps);// off surface point => distance = eps
+			eps *= -1;
+		}
+
+		const uint64_t cacheKey = HashFit(points, normals);
+		if (!m_options.cacheDirectory.empty() && LoadCoefficients(cacheKey, (unsigned int)points.size()))
+			return;
+
+		// points whose on surface samples are the centers, in the order of m_centerIndex
+		std::vector<unsigned int> centerPoints;
+		if (m_options.greedyCenters)
+		{
+			FitGreedy((unsigned int)points.size(), centerPoints);
+		}
+		else
+		{
+			m_numCenters = (unsigned int)points.size();
+
+			m_centerIndex.resize(m_numCenters);
+			for (unsigned int i = 0; i < m_numCenters; i++)
+				m_centerIndex[i] = i;
+			centerPoints = m_centerIndex;
+			PackCenters();
+
+			// build and solve the linear system of equations
+			m_coefficents = VectorXd::Zero(m_numCenters + 4); // result of the linear system
+			SolveCoefficients();
+		}
+
+		if (!m_options.cacheDirectory.empty())
+			StoreCoefficients(cacheKey, centerPoints);
+	}
+
+	//! Content hash of the input points and normals and of all options that change the solution.
+	uint64_t HashFit(const std::vector<Vector3d>& points, const std::vector<Vector3d>& normals) const
+	{
+		uint64_t key = HashString("RBF r^3 v1", HashBytes(nullptr, 0));
+		key = HashValue(points.size(), key);
+		if (!points.empty())
+		{
+			key = HashBytes(points[0].data(), points.size() * sizeof(Vector3d), key);
+			key = HashBytes(normals[0].data(), normals.size() * sizeof(Vector3d), key);
+		}
+		key = HashValue(m_lambda, key);
+		return HashRBFOptions(m_options, key);
+	}
+
+	//! Writes the fit to the cache: the center points and [lambda, coefficients] as two blobs.
+	void StoreCoefficients(uint64_t key, const std::vector<unsigned int>& centerPoints) const
+	{
+		BlobCache cache(m_options.cacheDirectory);
+		VectorXd data(1 + m_coefficents.size());
+		data << m_lambda, m_coefficents;
+		if (!cache.Store("rbf_centers", key, centerPoints.data(), centerPoints.size()) || !cache.Store("rbf_coefficients", key, data.data(), data.size()))
+			std::cerr << "Could not write the RBF cache to " << m_options.cacheDirectory << std::endl;
+	}
+
+	//! Restores a cached fit to the function samples built by Fit(), returns false on a miss.
+	//! A greedy fit only keeps the samples of its centers (in the order they were selected), as FitGreedy() does.
+	bool LoadCoefficients(uint64_t key, unsigned int numPoints)
+	{
+		BlobCache cache(m_options.cacheDirectory);
+		std::vector<unsigned int> centerPoints;
+		std::vector<double> data;
+		if (!cache.Load("rbf_centers", key, centerPoints) || !cache.Load("rbf_coefficients", key, data)) return false;
+		if (data.size() != centerPoints.size() + 5) return false;
+		for (unsigned int p : centerPoints)
+			if (p >= numPoints) return false;
+
+		m_numCenters = (unsigned int)centerPoints.size();
+		if (m_options.greedyCenters)
+		{
+			FunctionSamples allSamples;
+			std::swap(allSamples, m_funcSamp);
+			m_centerIndex.resize(m_numCenters);
+			for (unsigned int i = 0; i < m_numCenters; ++i)
+			{
+				const unsigned int p = centerPoints[i];
+				m_centerIndex[i] = 2 * i;
+				m_funcSamp.insertSample(allSamples.m_pos[p], allSamples.m_val[p]);
+				m_funcSamp.insertSample(allSamples.m_pos[numPoints + p], allSamples.m_val[numPoints + p]);
+			}
+		}
+		else
+		{
+			m_centerIndex = centerPoints;
+		}
+		PackCenters();
+
+		m_lambda = data[0];
+		m_coefficents = Eigen::Map<const VectorXd>(data.data() + 1, data.size() - 1);
+		m_centerWeight = m_coefficents.head(m_numCenters).array();
+		if (m_options.verbose)
+			std::cerr << "Loaded " << m_numCenters << " RBF coefficients from the cache" << std::endl;
+		return true;
+	}
+
+	//! Solves for the coefficients of the current centers; the matrix-free solver starts from m_coefficents.
+	void SolveCoefficients()
+	{
+		const unsigned int dim = m_numCenters + 4;
+		m_rhs = VectorXd(dim);
+		const RBFSolverType solver = SelectSolver(m_options.solver, dim);
+		if (solver == RBFSolverType::ConjugateGradient)
+		{
+			// there is no matrix to decompose for the sweep
+			if (m_options.selectLambda)
+				std::cerr << "RBF: selectLambda needs a direct solver, using lambda = " << m_lambda << " with matrix-free CG" << std::endl;
+			SolveSystemMatrixFree();
+		}
+		else
+		{
+			BuildSystem();
+			if (m_options.selectLambda)
+			{
+				SolveRegularizationPath();
+				if (m_options.keepFactorization) FactorizeIncremental();
+			}
+			else if (!m_options.keepFactorization || !FactorizeIncremental())
+			{
+				SolveSystem(solver);
+			}
+
+			// the system matrix is not needed anymore
+			m_systemMatrix.resize(0, 0);
+		}
+		m_centerWeight = m_coefficents.head(m_numCenters).array();
+	}
+
+	//! Chooses the regularization weight by generalized cross-validation (GCV) and solves for the coefficients.
+	//! With the eigendecomposition  A^T A = V D V^T  and  g = V^T A^T b  the solution for any lambda is  x = V (D + lambda^2 I)^-1 g,
+	//! so the whole sweep costs a single decomposition. GCV(lambda) = n ||A x - b||^2 / (n - tr H)^2 with the influence matrix
+	//! H = A (A^T A + lambda^2 I)^-1 A^T, where  tr H = sum_i d_i / (d_i + lambda^2)  and the residual follows from the decomposition
+	//! as well:  ||A x - b||^2 = ||b_perp||^2 + sum_i (lambda^2 / (d_i + lambda^2))^2 g_i^2 / d_i,  b_perp is the part of b outside
+	//! the range of A. Sets m_lambda and adds it to m_systemMatrix again (e.g. for the factorization that is kept for updates).
+	void SolveRegularizationPath()
+	{
+		// A^T A without the regularizer
+		m_systemMatrix.diagonal().array() -= m_lambda * m_lambda;
+
+		if (m_options.verbose) std::cerr << "Computing eigendecomposition..." << std::endl;
+		const Eigen::SelfAdjointEigenSolver<MatrixXd> eig(m_systemMatrix);
+		const VectorXd d = eig.eigenvalues().cwiseMax(0.0);
+		const VectorXd g = eig.eigenvectors().transpose() * m_rhs;
+
+		// directions with (numerically) zero eigenvalues do not contribute to the fit
+		const double n = (double)m_funcSamp.m_val.size();
+		const double dMin = d.maxCoeff() * std::numeric_limits<double>::epsilon() * d.size();
+		const Eigen::Map<const VectorXd> b(m_funcSamp.m_val.data(), m_funcSamp.m_val.size());
+		double residualPerp = b.squaredNorm();
+		for (Eigen::Index i = 0; i < d.size(); ++i)
+			if (d[i] > dMin) residualPerp -= g[i] * g[i] / d[i];
+		residualPerp = std::max(0.0, residualPerp);
+
+		double bestLambda = m_lambda, bestGCV = std::numeric_limits<double>::max();
+		for (unsigned int k = 0; k < m_options.numLambdas; ++k)
+		{
+			const double t = m_options.numLambdas > 1 ? (double)k / (m_options.numLambdas - 1) : 0.0;
+			const double lambda = m_options.lambdaMin * pow(m_options.lambdaMax / m_options.lambdaMin, t);
+			const double l2 = lambda * lambda;
+
+			double traceH = 0.0, residual = residualPerp;
+			for (Eigen::Index i = 0; i < d.size(); ++i)
+			{
+				if (d[i] <= dMin) continue;
+				const double damping = l2 / (d[i] + l2);
+				traceH += d[i] / (d[i] + l2);
+				residual += damping * damping * g[i] * g[i] / d[i];
+			}
+
+			const double gcv = n * residual / ((n - traceH) * (n - traceH));
+			if (gcv < bestGCV)
+			{
+				bestGCV = gcv;
+				bestLambda = lambda;
+			}
+		}
+
+		m_lambda = bestLambda;
+		if (m_options.verbose) std::cerr << "Selected lambda = " << m_lambda << " (GCV " << bestGCV << ")" << std::endl;
+
+		m_coefficents = eig.eigenvectors() * (g.array() / (d.array() + m_lambda * m_lambda)).matrix();
+		m_systemMatrix.diagonal().array() += m_lambda * m_lambda;
+	}
+
+	//! Factorizes the system matrix into m_factor, which needs the unknowns in the order [polynomial, centers] (see AddCenters()).
+	//! Returns false if the system is not positive definite; m_systemMatrix stays intact.
+	bool FactorizeIncremental()
+	{
+		const unsigned int n = m_numCenters;
+		MatrixXd S(n + 4, n + 4);
+		S.topLeftCorner(4, 4).triangularView<Eigen::Lower>() = m_systemMatrix.bottomRightCorner(4, 4);
+		S.bottomLeftCorner(n, 4) = m_systemMatrix.bottomLeftCorner(4, n).transpose();
+		S.bottomRightCorner(n, n).triangularView<Eigen::Lower>() = m_systemMatrix.topLeftCorner(n, n);
+
+		if (m_options.verbose) std::cerr << "Computing LLT (kept for updates)..." << std::endl;
+		m_factor.reset(new IncrementalCholesky());
+		if (!m_factor->Compute(S))
+		{
+			m_factor.reset();
+			return false;
+		}
+
+		VectorXd rhs(n + 4);
+		rhs << m_rhs.tail(4), m_rhs.head(n);
+		const VectorXd x = m_factor->Solve(rhs);
+		m_coefficents << x.tail(n), x.head(4);
+		return true;
+	}
+
+	//! Adds new centers with their function samples to the fit and updates m_factor instead of recomputing it.
+	//! newSamples contains two samples per new point, the first one is the center (the on surface sample).
+	//! The new rows of A restricted to the old unknowns are a rank-k update of the old system, the kernels at the new centers border it
+	//! with new rows and columns (the polynomial unknowns come first, so that new centers are appended to the factor).
+	//! Returns false if the extended system is not positive definite: the new samples are removed again and the coefficients are
+	//! unchanged, but m_factor is dropped (it already contains the rank-k update).
+	bool AddCenters(const FunctionSamples& newSamples)
+	{
+		const unsigned int numOld = m_numCenters;
+		const unsigned int numNew = (unsigned int)newSamples.m_pos.size() / 2;
+		const unsigned int firstNewSample = (unsigned int)m_funcSamp.m_pos.size();
+		const unsigned int numChunks = GetNumThreads();
+
+		for (unsigned int i = 0; i < newSamples.m_pos.size(); i++)
+			m_funcSamp.insertSample(newSamples.m_pos[i], newSamples.m_val[i]);
+
+		// right hand side A^T b in the order of the factor
+		VectorXd rhs(numOld + numNew + 4);
+		rhs.head(numOld + 4) << m_rhs.tail(4), m_rhs.head(numOld);
+
+		// the new rows of A (restricted to the old unknowns) update the old system
+		MatrixXd rowsT(numOld + 4, 2 * numNew);
+		ComputeSystemRows(firstNewSample, 2 * numNew, rowsT);
+		MatrixXd V(numOld + 4, 2 * numNew);
+		V << rowsT.bottomRows(4), rowsT.topRows(numOld);
+		m_factor->RankUpdate(V);
+		rhs.head(numOld + 4) += V * Eigen::Map<const VectorXd>(&m_funcSamp.m_val[firstNewSample], 2 * numNew);
+
+		// the kernels at the new centers are new columns of A
+		const unsigned int numSamples = (unsigned int)m_funcSamp.m_pos.size();
+		MatrixXd K(numSamples, numNew);
+		ParallelFor(0, numNew, [&](size_t j) {
+			const Vector3d& c = m_funcSamp.m_pos[firstNewSample + 2 * j];
+			for (unsigned int i = 0; i < numSamples; ++i)
+				K(i, j) = EvalBasis((m_funcSamp.m_pos[i] - c).norm());
+		});
+
+		// off-diagonal block B = A_old^T K, with the rows of A_old generated block by block
+		std::vector<MatrixXd> partialB(numChunks, MatrixXd::Zero(numOld + 4, numNew));
+		ForEachRowBlock(numChunks, [&](const MatrixXd& blockT, unsigned int first, unsigned int count, unsigned int chunk) {
+			partialB[chunk].noalias() += blockT * K.middleRows(first, count);
+		});
+		MatrixXd B = MatrixXd::Zero(numOld + 4, numNew);
+		for (unsigned int c = 0; c < numChunks; ++c)
+		{
+			B.topRows(4) += partialB[c].bottomRows(4);
+			B.bottomRows(numOld) += partialB[c].topRows(numOld);
+		}
+
+		MatrixXd C = K.transpose() * K;
+		C.diagonal().array() += m_lambda * m_lambda;
+		if (!m_factor->Extend(B, C))
+		{
+			m_funcSamp.m_pos.resize(firstNewSample);
+			m_funcSamp.m_val.resize(firstNewSample);
+			m_factor.reset();
+			return false;
+		}
+
+		const Eigen::Map<const VectorXd> b(m_funcSamp.m_val.data(), numSamples);
+		rhs.tail(numNew) = K.transpose() * b;
+
+		for (unsigned int j = 0; j < numNew; ++j)
+			m_centerIndex.push_back(firstNewSample + 2 * j);
+		m_numCenters = numOld + numNew;
+		PackCenters();
+
+		// coefficients and right hand side in the order of Eval(): [centers, polynomial]
+		const VectorXd x = m_factor->Solve(rhs);
+		m_coefficents.resize(m_numCenters + 4);
+		m_coefficents << x.tail(m_numCenters), x.head(4);
+		m_centerWeight = m_coefficents.head(m_numCenters).array();
+		m_rhs.resize(m_numCenters + 4);
+		m_rhs << rhs.tail(m_numCenters), rhs.head(4);
+		return true;
+	}
+
 	double EvalBasis(double x)
 	{
 		return x*x*x;
@@ -304,67 +787,282 @@ private:
 	//! Computes the system matrix.
 	void BuildSystem()
 	{
-		MatrixXd A(2 * m_numCenters, m_numCenters + 4);
-		VectorXd b(2 * m_numCenters);
-		A.setZero();
-		b.setZero();
+		AssembleSystem(m_systemMatrix);
+	}
+
+	//! Computes the lower triangle of the system matrix A^T A + lambda^2 I in the precision of S, and A^T b in m_rhs (always double).
+	//! The rows of A are generated block by block from the function samples and accumulated into the lower triangle of
+	//! A^T A with symmetric rank-k updates, so that A is never stored. The upper triangle of S is not initialized.
+	template<typename Matrix>
+	void AssembleSystem(Matrix& S)
+	{
+		typedef typename Matrix::Scalar Scalar;
+		const unsigned int dim = m_numCenters + 4;
+		const unsigned int numRows = (unsigned int)m_funcSamp.m_pos.size();
+		const Eigen::Map<const VectorXd> b(m_funcSamp.m_val.data(), numRows);
+
+		S.setZero(dim, dim);
+		m_rhs.setZero(dim);
+
+		MatrixXd rowsT(dim, +kAssemblyBlock);
+		const unsigned int numPanels = (dim + kAssemblyPanel - 1) / kAssemblyPanel;
+		for (unsigned int first = 0; first < numRows; first += kAssemblyBlock)
+		{
+			const unsigned int count = std::min(numRows - first, +kAssemblyBlock);
+
+			// generate the block of rows in parallel
+			ParallelFor(0, (count + kRowBlock - 1) / kRowBlock, [&](size_t i) {
+				const unsigned int c0 = (unsigned int)i * kRowBlock;
+				const unsigned int nc = std::min(count - c0, +kRowBlock);
+				ComputeSystemRows(first + c0, nc, rowsT.middleCols(c0, nc));
+			});
+
+			m_rhs.noalias() += rowsT.leftCols(count) * b.segment(first, count);
+
+			// rank-k update of the lower triangle, one column panel per task
+			const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> block = rowsT.leftCols(count).template cast<Scalar>();
+			ParallelFor(0, numPanels, [&](size_t p) {
+				const unsigned int c0 = (unsigned int)p * kAssemblyPanel;
+				const unsigned int nc = std::min(dim - c0, +kAssemblyPanel);
+				S.block(c0, c0, dim - c0, nc).noalias() += block.middleRows(c0, dim - c0) * block.middleRows(c0, nc).transpose();
+			});
+		}
+
+		// regularizer -> smoother surface
+		// pushes the coefficients to zero
+		S.diagonal().array() += Scalar(m_lambda * m_lambda);
+	}
+
+	//! Solves the normal equations with a dense factorization; m_systemMatrix is overwritten by the factor.
+	void SolveSystem(RBFSolverType solver)
+	{
+		if (m_options.verbose) std::cerr << "Solving RBF System" << std::endl;
 
-		// TODO fill the matrix A and the vector b as described in the exercise sheet
-		// note that all sample points (both on and off surface points) are stored in m_funcSamp
-		// you can access matrix elements using for example A(i,j) for the i-th row and j-th column
-		// similar you access the elements of the vector b, e.g. b(i) for the i-th element
+		if (!SolveDenseSPD(m_systemMatrix, m_rhs, m_coefficents, solver, m_options.verbose))
+		{
+			if (m_options.verbose) std::cerr << "System is not positive definite, falling back to LDLT" << std::endl;
+			BuildSystem();
+			SolveDenseSPD(m_systemMatrix, m_rhs, m_coefficents, RBFSolverType::LDLT, m_options.verbose);
+		}
+
+		if (m_options.verbose) std::cerr << "Done." << std::endl;
+	}
 
-		for (int i = 0; i < 2 * m_numCenters; ++i)
+	//! Computes the rows [first, first + count) of the least squares matrix A on the fly.
+	//! The rows are stored as the columns of rowsT (one contiguous column per function sample), rowsT must have count columns.
+	void ComputeSystemRows(unsigned int first, unsigned int count, Eigen::Ref<MatrixXd> rowsT) const
+	{
+		for (unsigned int i = 0; i < count; ++i)
 		{
-			Vector3d xi = m_funcSamp.m_pos[i];
-			for (int j = 0; j < m_numCenters; ++j)
+			const Vector3d& xi = m_funcSamp.m_pos[first + i];
+			rowsT.col(i).head(m_numCenters) = ((m_centerX - xi.x()).square() + (m_centerY - xi.y()).square() + (m_centerZ - xi.z()).square()).sqrt().cube().matrix();
+			rowsT.col(i).tail(4) << xi.x(), xi.y(), xi.z(), 1.0;
+		}
+	}
+
+	//! Calls func(rowsT, first, count, chunk) for consecutive blocks of rows of A (see ComputeSystemRows()).
+	//! The rows are split into one chunk per thread, the blocks of a chunk are processed sequentially by the same thread.
+	template<typename Func>
+	void ForEachRowBlock(unsigned int numChunks, const Func& func) const
+	{
+		const unsigned int numRows = (unsigned int)m_funcSamp.m_pos.size();
+		ParallelFor(0, numChunks, [&](size_t chunk) {
+			const unsigned int begin = (unsigned int)(numRows * (uint64_t)chunk / numChunks);
+			const unsigned int end = (unsigned int)(numRows * (uint64_t)(chunk + 1) / numChunks);
+			MatrixXd rowsT;
+			for (unsigned int first = begin; first < end; first += kRowBlock)
 			{
-				double r = (xi - m_funcSamp.m_pos[j]).norm();
-				A(i, j) = EvalBasis(r);  // φ(||xi - xj||)
+				const unsigned int count = std::min(end - first, +kRowBlock);
+				rowsT.resize(m_numCenters + 4, count);
+				ComputeSystemRows(first, count, rowsT);
+				func(rowsT, first, count, (unsigned int)chunk);
 			}
+		});
+	}
+
+	//! Solves the normal equations with conjugate gradients. A^T A is applied as A^T (A x), where the rows of A are regenerated
+	//! block by block in every iteration, so that the memory stays linear in the number of points.
+	void SolveSystemMatrixFree()
+	{
+		if (m_options.verbose) std::cerr << "Solving RBF System (matrix-free CG)" << std::endl;
+
+		const unsigned int dim = m_numCenters + 4;
+		const unsigned int numChunks = GetNumThreads();
+		const Eigen::Map<const VectorXd> b(m_funcSamp.m_val.data(), m_funcSamp.m_val.size());
 
-			A(i, m_numCenters + 0) = xi.x();
-			A(i, m_numCenters + 1) = xi.y();
-			A(i, m_numCenters + 2) = xi.z();
-			A(i, m_numCenters + 3) = 1.0;
+		// right hand side A^T b and the diagonal of A^T A for the Jacobi preconditioner
+		std::vector<VectorXd> partialRhs(numChunks, VectorXd::Zero(dim)), partialDiag(numChunks, VectorXd::Zero(dim));
+		ForEachRowBlock(numChunks, [&](const MatrixXd& rowsT, unsigned int first, unsigned int count, unsigned int chunk) {
+			partialRhs[chunk].noalias() += rowsT * b.segment(first, count);
+			partialDiag[chunk] += rowsT.rowwise().squaredNorm();
+		});
 
-			b(i) = m_funcSamp.m_val[i];
+		VectorXd diagonal = VectorXd::Constant(dim, m_lambda * m_lambda);
+		m_rhs.setZero();
+		for (unsigned int c = 0; c < numChunks; ++c)
+		{
+			m_rhs += partialRhs[c];
+			diagonal += partialDiag[c];
 		}
 
-		// build the system matrix and the right hand side of the normal equation
-		m_systemMatrix = A.transpose() * A;
-		m_rhs = A.transpose() * b;
+		auto applySystem = [&](const VectorXd& v, VectorXd& result) { ApplySystem(v, result); };
+		SolveConjugateGradient(applySystem, diagonal, m_rhs, m_coefficents, m_options.cgTolerance, m_options.cgMaxIterations, m_options.verbose);
 
-		// regularizer -> smoother surface
-		// pushes the coefficients to zero
-		double lambda = 0.0001;
-		m_systemMatrix.diagonal() += lambda * lambda * VectorXd::Ones(m_numCenters + 4);
+		if (m_options.verbose) std::cerr << "Done." << std::endl;
 	}
 
-	void SolveSystem()
+	//! Computes result = (A^T A + lambda^2 I) v as A^T (A v), the rows of A are regenerated block by block.
+	void ApplySystem(const VectorXd& v, VectorXd& result) const
 	{
-		std::cerr << "Solving RBF System" << std::endl;
-		std::cerr << "Computing LU..." << std::endl;
+		const unsigned int numChunks = GetNumThreads();
+		std::vector<VectorXd> partial(numChunks, VectorXd::Zero(v.size()));
+		ForEachRowBlock(numChunks, [&](const MatrixXd& rowsT, unsigned int, unsigned int, unsigned int chunk) {
+			partial[chunk].noalias() += rowsT * (rowsT.transpose() * v);
+		});
+		result = m_lambda * m_lambda * v;
+		for (unsigned int c = 0; c < numChunks; ++c)
+			result += partial[c];
+	}
 
-		FullPivLU<Matrix<double, Dynamic, Dynamic>> LU(m_systemMatrix);
-		m_coefficents = LU.solve(m_rhs);
+	//! Greedy center selection for the function samples in m_funcSamp (on surface samples first, see Fit()).
+	//! Starts with the kernels at a random subset of the points and fits the function samples of the selected points. Then the
+	//! residuals at all samples are evaluated and the points with the largest residuals are added (see AddCenters()), until the
+	//! tolerance is met. Afterwards m_funcSamp only contains the samples of the selected points.
+	void FitGreedy(unsigned int numPoints, std::vector<unsigned int>& centerPoints)
+	{
+		FunctionSamples allSamples;
+		std::swap(allSamples, m_funcSamp);
+		const unsigned int numSamples = (unsigned int)allSamples.m_pos.size();
 
-		std::cerr << "Done." << std::endl;
+		Eigen::ArrayXd sampleX(numSamples), sampleY(numSamples), sampleZ(numSamples), sampleF(numSamples);
+		for (unsigned int i = 0; i < numSamples; ++i)
+		{
+			sampleX[i] = allSamples.m_pos[i].x();
+			sampleY[i] = allSamples.m_pos[i].y();
+			sampleZ[i] = allSamples.m_pos[i].z();
+		}
+
+		// random initial subset
+		std::vector<unsigned int> newPoints(numPoints);
+		for (unsigned int i = 0; i < numPoints; ++i) newPoints[i] = i;
+		std::mt19937 rng(0);
+		std::shuffle(newPoints.begin(), newPoints.end(), rng);
+		newPoints.resize(std::min(m_options.greedyInitialCenters, numPoints));
+
+		// empty fit: only the polynomial with the regularizer
+		std::vector<bool> selected(numPoints, false);
+		m_numCenters = 0;
+		m_centerIndex.clear();
+		PackCenters();
+		m_rhs = VectorXd::Zero(4);
+		m_factor.reset(new IncrementalCholesky());
+		m_factor->Compute(m_lambda * m_lambda * MatrixXd::Identity(4, 4));
+
+		double maxResidual = 0.0;
+		while (!newPoints.empty())
+		{
+			FunctionSamples newSamples;
+			for (unsigned int p : newPoints)
+			{
+				selected[p] = true;
+				newSamples.insertSample(allSamples.m_pos[p], allSamples.m_val[p]);
+				newSamples.insertSample(allSamples.m_pos[numPoints + p], allSamples.m_val[numPoints + p]);
+			}
+			if (!AddCenters(newSamples))
+			{
+				if (m_options.verbose) std::cerr << "Greedy center selection: system is not positive definite, stopping" << std::endl;
+				break;
+			}
+			centerPoints.insert(centerPoints.end(), newPoints.begin(), newPoints.end());
+
+			// residuals at all function samples
+			const size_t numBlocks = (numSamples + kResidualBlock - 1) / kResidualBlock;
+			ParallelFor(0, numBlocks, [&](size_t blk) {
+				const size_t first = blk * kResidualBlock;
+				const size_t count = std::min<size_t>(kResidualBlock, numSamples - first);
+				EvalBatch(&sampleX[first], &sampleY[first], &sampleZ[first], &sampleF[first], count);
+			});
+			Eigen::ArrayXd residual(numPoints);
+			for (unsigned int p = 0; p < numPoints; ++p)
+				residual[p] = std::max(fabs(sampleF[p] - allSamples.m_val[p]), fabs(sampleF[numPoints + p] - allSamples.m_val[numPoints + p]));
+			maxResidual = residual.maxCoeff();
+
+			// the worst fitted points that are not yet centers
+			newPoints.clear();
+			for (unsigned int p = 0; p < numPoints; ++p)
+				if (!selected[p] && residual[p] > m_options.greedyTolerance) newPoints.push_back(p);
+			const size_t numAdd = std::min<size_t>(m_options.greedyCentersPerIteration, newPoints.size());
+			std::partial_sort(newPoints.begin(), newPoints.begin() + numAdd, newPoints.end(), [&](unsigned int a, unsigned int b) { return residual[a] > residual[b]; });
+			newPoints.resize(numAdd);
+		}
+
+		if (!m_options.keepFactorization)
+			m_factor.reset();
+
+		if (m_options.verbose)
+			std::cerr << "Greedy center selection: " << m_numCenters << " of " << numPoints << " centers, max. residual " << maxResidual << std::endl;
 	}
 
-	// point cloud
-	PointCloud m_pointcloud;
+	//! Copies the centers (the function samples m_centerIndex) into SoA arrays for the system assembly and the evaluation kernels.
+	void PackCenters()
+	{
+		m_centerX.resize(m_numCenters);
+		m_centerY.resize(m_numCenters);
+		m_centerZ.resize(m_numCenters);
+		for (unsigned int i = 0; i < m_numCenters; ++i)
+		{
+			const Vector3d& c = m_funcSamp.m_pos[m_centerIndex[i]];
+			m_centerX[i] = c.x();
+			m_centerY[i] = c.y();
+			m_centerZ[i] = c.z();
+		}
+	}
+
+	//! Number of query points / centers per tile of the blocked evaluation kernel.
+	static const Eigen::Index kQueryTile = 64;
+	static const Eigen::Index kCenterTile = 256;
+
+	//! Number of rows of A that are generated at once by one thread.
+	static const unsigned int kRowBlock = 64;
+
+	//! Number of rows of A per rank-k update and width of the column panels of the update in BuildSystem().
+	static const unsigned int kAssemblyBlock = 256;
+	static const unsigned int kAssemblyPanel = 128;
+
+	//! Number of function samples per task of the residual evaluation in FitGreedy().
+	static const unsigned int kResidualBlock = 1024;
+
+	RBFOptions m_options;
+
+	//! Weight of the regularizer (chosen by SolveRegularizationPath() if RBFOptions::selectLambda is set).
+	double m_lambda = 0.0001;
+
+	//! Offset of the next off surface sample along the normal (the sign alternates from point to point).
+	double m_offset = 0.01f;
 
 	//! The given function samples (at each function sample, we place a basis function).
 	FunctionSamples m_funcSamp;
 
-	//! The number of center = number of function samples.
+	//! The number of centers (= number of points, or the selected points in the greedy mode).
 	unsigned int m_numCenters;
 
+	//! Indices of the function samples that are the centers of the kernels.
+	std::vector<unsigned int> m_centerIndex;
+
+	//! SoA copy of the centers and their kernel coefficients (see PackCenters(), the weights are set after the solve).
+	Eigen::ArrayXd m_centerX, m_centerY, m_centerZ, m_centerWeight;
+
+	//! Octree over the centers for the approximate evaluation (nullptr -> exact evaluation).
+	std::unique_ptr<RBFTreecode> m_treecode;
+	double m_approximationTolerance = 0.0;
+
+	//! Cholesky factor of the normal equations with the unknowns in the order [polynomial, centers], if kept for AppendSamples().
+	std::unique_ptr<IncrementalCholesky> m_factor;
+
 	//! the right hand side of our system of linear equation. Unfortunately, float-precision is not enough, so we have to use double here.
 	VectorXd m_rhs;
 
-	//! the system matrix. Unfortunately, float-precision is not enough, so we have to use double here
+	//! the system matrix (lower triangle, freed after the solve). Unfortunately, float-precision is not enough, so we have to use double here
 	MatrixXd m_systemMatrix;
 
 	//! store the result of the linear system here. Unfortunately, float-precision is not enough, so we have to use double here
@@ -0,0 +1,174 @@
+#pragma once
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <algorithm>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//! A file that is mapped into memory for reading and writing, so that arrays larger than the main memory can be used in place:
+//! the operating system pages the data in on access and writes modified pages back to the file.
+//! Prefetch() and Evict() are hints for sequential passes, e.g. the next and the previous slab of a volume.
+class MappedFile
+{
+public:
+	MappedFile() {}
+	~MappedFile() { Close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	//! Maps the file read/write, after creating it or changing its size to size bytes. The content of an existing file is kept
+	//! (up to size), new bytes are zero. Returns false if the file cannot be opened or mapped.
+	bool Open(const std::string& path, size_t size)
+	{
+		Close();
+		if (size == 0) return false;
+
+#ifdef _WIN32
+		m_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (m_file == INVALID_HANDLE_VALUE) return false;
+
+		// the mapping of a larger size extends the file
+		LARGE_INTEGER fileSize;
+		fileSize.QuadPart = (LONGLONG)size;
+		if (!SetFilePointerEx(m_file, fileSize, NULL, FILE_BEGIN) || !SetEndOfFile(m_file))
+		{
+			Close();
+			return false;
+		}
+		m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READWRITE, fileSize.HighPart, fileSize.LowPart, NULL);
+		if (m_mapping == NULL)
+		{
+			Close();
+			return false;
+		}
+		m_data = (char*)MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+#else
+		m_file = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+		if (m_file < 0) return false;
+
+		// ftruncate() extends the file with holes, they only take disk space when they are written
+		if (ftruncate(m_file, (off_t)size) != 0)
+		{
+			Close();
+			return false;
+		}
+		void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+		m_data = data == MAP_FAILED ? nullptr : (char*)data;
+#endif
+		if (!m_data)
+		{
+			Close();
+			return false;
+		}
+		m_size = size;
+		return true;
+	}
+
+	//! Unmaps the file; modified pages are written back by the operating system.
+	void Close()
+	{
+#ifdef _WIN32
+		if (m_data) UnmapViewOfFile(m_data);
+		if (m_mapping != NULL) CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+		m_mapping = NULL;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if (m_data) munmap(m_data, m_size);
+		if (m_file >= 0) close(m_file);
+		m_file = -1;
+#endif
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+	inline bool IsOpen() const { return m_data != nullptr; }
+	inline char* GetData() const { return m_data; }
+	inline size_t GetSize() const { return m_size; }
+
+	//! Asks the operating system to read the pages of [offset, offset + size) ahead of their use.
+	void Prefetch(size_t offset, size_t size) const
+	{
+#ifndef _WIN32
+		Advise(offset, size, MADV_WILLNEED);
+#endif
+	}
+
+	//! Releases the pages of [offset, offset + size) from the memory of the process. They stay valid: modified pages are written
+	//! to the file, and the next access reads them again.
+	void Evict(size_t offset, size_t size) const
+	{
+#ifdef _WIN32
+		// unlocking pages that are not locked removes them from the working set
+		size_t begin, end;
+		if (PageRange(offset, size, begin, end)) VirtualUnlock(m_data + begin, end - begin);
+#else
+		Advise(offset, size, MADV_DONTNEED);
+#endif
+	}
+
+	//! Writes the modified pages to the file and waits for the writes to complete.
+	bool Flush() const
+	{
+		if (!m_data) return false;
+#ifdef _WIN32
+		return FlushViewOfFile(m_data, m_size) && FlushFileBuffers(m_file);
+#else
+		return msync(m_data, m_size, MS_SYNC) == 0;
+#endif
+	}
+
+private:
+
+	//! The pages that overlap [offset, offset + size), clipped to the file.
+	bool PageRange(size_t offset, size_t size, size_t& begin, size_t& end) const
+	{
+		if (!m_data || offset >= m_size || size == 0) return false;
+
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		const size_t pageSize = info.dwPageSize;
+#else
+		const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+		begin = offset / pageSize * pageSize;
+		end = std::min(m_size, offset + size);
+		return true;
+	}
+
+#ifndef _WIN32
+	void Advise(size_t offset, size_t size, int advice) const
+	{
+		size_t begin, end;
+		if (PageRange(offset, size, begin, end)) madvise(m_data + begin, end - begin, advice);
+	}
+#endif
+
+#ifdef _WIN32
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = NULL;
+#else
+	int m_file = -1;
+#endif
+	char* m_data = nullptr;
+	size_t m_size = 0;
+};
+
+#endif // MAPPED_FILE_H
@@ -3,8 +3,15 @@
 #ifndef MARCHING_CUBES_H
 #define MARCHING_CUBES_H
 
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <functional>
+#include <mutex>
+
 #include "SimpleMesh.h"
 #include "Volume.h"
+#include "Parallel.h"
 
 struct MC_Triangle {
 	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -24,7 +31,7 @@ struct MC_Gridcell_2 {
 	Vector3d ev0[8];
 };
 
-int edgeTable[256] = {
+constexpr uint16_t edgeTable[256] = {
 	0x0  , 0x109, 0x203, 0x30a, 0x406, 0x50f, 0x605, 0x70c,
 	0x80c, 0x905, 0xa0f, 0xb06, 0xc0a, 0xd03, 0xe09, 0xf00,
 	0x190, 0x99 , 0x393, 0x29a, 0x596, 0x49f, 0x795, 0x69c,
@@ -59,7 +66,7 @@ int edgeTable[256] = {
 	0x70c, 0x605, 0x50f, 0x406, 0x30a, 0x203, 0x109, 0x0
 };
 
-int triTable[256][16] = {
+constexpr int8_t triTable[256][16] = {
 	{ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
 	{ 0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
 	{ 0, 1, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
@@ -417,7 +424,8 @@ int Polygonise(MC_Gridcell grid, double isolevel, MC_Triangle* triangles) {
 }
 
 
-bool ProcessVolumeCell(Volume* vol, int x, int y, int z, double iso, SimpleMesh* mesh)
+template<typename T>
+bool ProcessVolumeCell(VolumeT<T>* vol, int x, int y, int z, double iso, SimpleMesh* mesh)
 {
 	MC_Gridcell cell;
 
@@ -474,4 +482,226 @@ bool ProcessVolumeCell(Volume* vol, int x, int y, int z, double iso, SimpleMesh*
 	return true;
 }
 
+//! Cube edges as seen from a pair of neighbouring yz-slices x and x + 1 (corner and edge numbering of Polygonise()):
+//! the axis of the edge, the slice of a y- or z-edge (0: x, 1: x + 1) and the offset of its first corner from the corner (x, y, z).
+struct MC_EdgeInfo
+{
+	uint8_t axis, slice, dy, dz;
+};
+
+constexpr MC_EdgeInfo mcEdgeInfo[12] = {
+	{ 0, 0, 0, 0 }, { 1, 0, 0, 0 }, { 0, 0, 1, 0 }, { 1, 1, 0, 0 },
+	{ 0, 0, 0, 1 }, { 1, 0, 0, 1 }, { 0, 0, 1, 1 }, { 1, 1, 0, 1 },
+	{ 2, 1, 0, 0 }, { 2, 0, 0, 0 }, { 2, 0, 1, 0 }, { 2, 1, 1, 0 }
+};
+
+//! Vertex indices of the y- and z-edges of a yz-slice (-1: no vertex), used to stitch slabs that share this slice.
+struct MC_SliceEdges
+{
+	std::vector<int> yEdges, zEdges;
+};
+
+//! Extracts the iso-surface of the cells x0 <= x < x1 (default: all) into an indexed mesh with shared vertices.
+//! The cells are processed per pair of neighbouring yz-slices; x is the outermost index of the volume, so a slice is contiguous
+//! in memory. The vertex index of every edge that crosses the iso value is cached when it is interpolated, so each vertex is
+//! created exactly once: the caches of the y- and z-edges of the slice x + 1 are handed on to the next pair, the cache of the
+//! x-edges between the two slices is only needed for the current pair. Returns the number of triangles.
+//! Optionally returns the vertices on the edges of the first and the last slice (x0 and x1).
+//! Bricks of 8^3 cells whose value range does not contain the iso value are skipped (see VolumeT::updateBrickRanges()).
+//! A mapped volume is streamed slab by slab (see VolumeT::adviseSequential()).
+template<typename T>
+inline size_t ExtractIsoSurface(VolumeT<T>* vol, double iso, SimpleMesh* mesh, uint x0 = 0, uint x1 = std::numeric_limits<uint>::max(),
+	MC_SliceEdges* firstSlice = nullptr, MC_SliceEdges* lastSlice = nullptr)
+{
+	const uint dx = vol->getDimX(), dy = vol->getDimY(), dz = vol->getDimZ();
+	x1 = std::min(x1, dx - 1);
+	if (dy < 2 || dz < 2 || x0 >= x1) return 0;
+	vol->updateBrickRanges();
+
+	const size_t sliceSize = (size_t)dy * dz;
+	const size_t numTriangles = mesh->GetTriangles().size();
+
+	// values of the two slices (decoded into the buffers unless the volume stores doubles)
+	std::vector<double> buffers[2];
+	vol->adviseSequential(x0, x0);
+	const double* slice[2] = { nullptr, vol->getSlice(x0, buffers[1]) };
+
+	// vertex indices (-1: not created yet) of the x-edges of the pair and of the y- and z-edges of both slices
+	std::vector<int> xEdges(sliceSize), yEdges[2], zEdges[2];
+	for (int s = 0; s < 2; ++s)
+	{
+		yEdges[s].assign(sliceSize, -1);
+		zEdges[s].assign(sliceSize, -1);
+	}
+
+	for (uint x = x0; x < x1; ++x)
+	{
+		std::swap(buffers[0], buffers[1]);
+		slice[0] = slice[1];
+		vol->adviseSequential(x + 1, x0);
+		slice[1] = vol->getSlice(x + 1, buffers[1]);
+		std::fill(xEdges.begin(), xEdges.end(), -1);
+
+		// returns the vertex on an edge, given by the slice and the coordinates of its first corner
+		auto getVertex = [&](const MC_EdgeInfo& edge, uint y, uint z) -> unsigned int {
+			const size_t i = (size_t)y * dz + z;
+			int& cached = edge.axis == 0 ? xEdges[i] : (edge.axis == 1 ? yEdges[edge.slice][i] : zEdges[edge.slice][i]);
+			if (cached >= 0) return (unsigned int)cached;
+
+			const size_t j = edge.axis == 0 ? i : (edge.axis == 1 ? i + dz : i + 1);
+			const double v0 = edge.axis == 0 ? slice[0][i] : slice[edge.slice][i];
+			const double v1 = edge.axis == 0 ? slice[1][i] : slice[edge.slice][j];
+			const uint xs = x + (edge.axis == 0 ? 0 : edge.slice);
+			const Vector3d p0(vol->posX(xs), vol->posY(y), vol->posZ(z));
+			const Vector3d p1(vol->posX(xs + (edge.axis == 0)), vol->posY(y + (edge.axis == 1)), vol->posZ(z + (edge.axis == 2)));
+
+			Vertex vertex = VertexInterp(iso, p0, p1, v0, v1).cast<float>();
+			cached = (int)mesh->AddVertex(vertex);
+			return (unsigned int)cached;
+		};
+
+		for (uint y = 0; y + 1 < dy; ++y)
+		{
+			for (uint z = 0; z + 1 < dz; ++z)
+			{
+				// bricks without the iso-surface have no cells with triangles
+				if (!(z & (kVolumeBrickSize - 1)) && vol->isBrickEmpty(x >> kVolumeBrickShift, y >> kVolumeBrickShift, z >> kVolumeBrickShift, iso))
+				{
+					z += kVolumeBrickSize - 1;
+					continue;
+				}
+
+				const size_t i = (size_t)y * dz + z;
+				int cubeindex = 0;
+				if (slice[1][i] < iso) cubeindex |= 1;
+				if (slice[0][i] < iso) cubeindex |= 2;
+				if (slice[0][i + dz] < iso) cubeindex |= 4;
+				if (slice[1][i + dz] < iso) cubeindex |= 8;
+				if (slice[1][i + 1] < iso) cubeindex |= 16;
+				if (slice[0][i + 1] < iso) cubeindex |= 32;
+				if (slice[0][i + dz + 1] < iso) cubeindex |= 64;
+				if (slice[1][i + dz + 1] < iso) cubeindex |= 128;
+				if (edgeTable[cubeindex] == 0) continue;
+
+				const int8_t* tris = triTable[cubeindex];
+				for (int t = 0; tris[t] != -1; t += 3)
+				{
+					unsigned int idx[3];
+					for (int k = 0; k < 3; ++k)
+					{
+						const MC_EdgeInfo& edge = mcEdgeInfo[tris[t + k]];
+						idx[k] = getVertex(edge, y + edge.dy, z + edge.dz);
+					}
+					mesh->AddFace(idx[0], idx[1], idx[2]);
+				}
+			}
+		}
+
+		if (firstSlice && x == x0)
+		{
+			firstSlice->yEdges = yEdges[0];
+			firstSlice->zEdges = zEdges[0];
+		}
+		if (lastSlice && x + 1 == x1)
+		{
+			lastSlice->yEdges = yEdges[1];
+			lastSlice->zEdges = zEdges[1];
+		}
+
+		// the slice x + 1 is the first slice of the next pair
+		std::swap(yEdges[0], yEdges[1]);
+		std::swap(zEdges[0], zEdges[1]);
+		std::fill(yEdges[1].begin(), yEdges[1].end(), -1);
+		std::fill(zEdges[1].begin(), zEdges[1].end(), -1);
+	}
+
+	return mesh->GetTriangles().size() - numTriangles;
+}
+
+//! Called with the number of finished slabs and the number of all slabs.
+typedef std::function<void(size_t, size_t)> MC_ProgressCallback;
+
+//! Number of slices per slab of ExtractIsoSurfaceParallel().
+const uint kMCSlabThickness = 8;
+
+//! Multithreaded ExtractIsoSurface(): the volume is split into slabs of kMCSlabThickness slices along x, which are extracted in
+//! parallel into meshes of their own. Neighbouring slabs share a slice; when the slab meshes are appended in slab order, the
+//! vertices on this slice are taken from the lower slab and the duplicates of the upper slab are dropped. Since the slabs do not
+//! depend on the number of threads, the result is deterministic (and equal to the one of ExtractIsoSurface()).
+//! The progress callback is called once per finished slab (serialized, but from the worker threads).
+template<typename T>
+inline size_t ExtractIsoSurfaceParallel(VolumeT<T>* vol, double iso, SimpleMesh* mesh, const MC_ProgressCallback& progress = MC_ProgressCallback())
+{
+	const uint numCells = vol->getDimX() > 0 ? vol->getDimX() - 1 : 0;
+	const size_t numSlabs = (numCells + kMCSlabThickness - 1) / kMCSlabThickness;
+
+	std::vector<SimpleMesh> slabMeshes(numSlabs);
+	std::vector<MC_SliceEdges> firstSlices(numSlabs), lastSlices(numSlabs);
+	std::mutex progressMutex;
+	size_t numFinished = 0;
+	// before the slabs, which only read the ranges
+	vol->updateBrickRanges();
+	ParallelFor(0, numSlabs, [&](size_t s) {
+		const uint x0 = (uint)s * kMCSlabThickness;
+		ExtractIsoSurface(vol, iso, &slabMeshes[s], x0, std::min(x0 + kMCSlabThickness, numCells), &firstSlices[s], &lastSlices[s]);
+
+		if (progress)
+		{
+			std::lock_guard<std::mutex> lock(progressMutex);
+			progress(++numFinished, numSlabs);
+		}
+	});
+
+	// merge in slab order
+	std::vector<Vertex>& vertices = mesh->GetVertices();
+	std::vector<Triangle>& triangles = mesh->GetTriangles();
+	size_t numVertices = vertices.size(), numTriangles = triangles.size();
+	for (SimpleMesh& slab : slabMeshes)
+	{
+		numVertices += slab.GetVertices().size();
+		numTriangles += slab.GetTriangles().size();
+	}
+	vertices.reserve(numVertices);
+	triangles.reserve(numTriangles);
+
+	const size_t firstTriangle = triangles.size();
+	std::vector<int> remap;
+	for (size_t s = 0; s < numSlabs; ++s)
+	{
+		std::vector<Vertex>& slabVertices = slabMeshes[s].GetVertices();
+		remap.assign(slabVertices.size(), -1);
+
+		// vertices on the first slice already exist as the vertices on the last slice of the previous slab
+		if (s > 0)
+		{
+			const MC_SliceEdges& shared = lastSlices[s - 1];
+			const MC_SliceEdges& duplicate = firstSlices[s];
+			for (size_t i = 0; i < duplicate.yEdges.size(); ++i)
+			{
+				if (duplicate.yEdges[i] >= 0) remap[duplicate.yEdges[i]] = shared.yEdges[i];
+				if (duplicate.zEdges[i] >= 0) remap[duplicate.zEdges[i]] = shared.zEdges[i];
+			}
+		}
+
+		for (size_t v = 0; v < slabVertices.size(); ++v)
+		{
+			if (remap[v] >= 0) continue;
+			remap[v] = (int)vertices.size();
+			vertices.push_back(slabVertices[v]);
+		}
+
+		// the slice indices of the next slab refer to the merged mesh
+		for (int& idx : lastSlices[s].yEdges) if (idx >= 0) idx = remap[idx];
+		for (int& idx : lastSlices[s].zEdges) if (idx >= 0) idx = remap[idx];
+
+		for (const Triangle& t : slabMeshes[s].GetTriangles())
+			triangles.push_back(Triangle(remap[t.idx0], remap[t.idx1], remap[t.idx2]));
+
+		// free the slab right away
+		slabMeshes[s] = SimpleMesh();
+	}
+
+	return triangles.size() - firstTriangle;
+}
+
 #endif // MARCHING_CUBES_H
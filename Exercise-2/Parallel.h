@@ -0,0 +1,55 @@
+#pragma once
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+//! Number of worker threads used by ParallelFor().
+inline unsigned int GetNumThreads()
+{
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+//! True while the calling thread executes the body of a ParallelFor().
+inline bool& InParallelRegion()
+{
+	static thread_local bool inside = false;
+	return inside;
+}
+
+//! Calls body(i) for every i in [begin, end), distributed dynamically over all hardware threads.
+//! The iterations must be independent; the call returns when all of them are done.
+//! Nested calls (from within a body) run sequentially on the calling thread instead of oversubscribing the cores.
+template<typename Body>
+void ParallelFor(size_t begin, size_t end, const Body& body)
+{
+	if (end <= begin) return;
+
+	const unsigned int numThreads = (unsigned int)std::min<size_t>(GetNumThreads(), end - begin);
+	if (numThreads == 1 || InParallelRegion())
+	{
+		for (size_t i = begin; i < end; ++i) body(i);
+		return;
+	}
+
+	std::atomic<size_t> next(begin);
+	auto worker = [&]() {
+		bool& inside = InParallelRegion();
+		const bool wasInside = inside;
+		inside = true;
+		for (size_t i = next++; i < end; i = next++) body(i);
+		inside = wasInside;
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int t = 1; t < numThreads; ++t)
+		threads.emplace_back(worker);
+	worker();
+	for (auto& t : threads) t.join();
+}
+
+#endif // PARALLEL_H
@@ -0,0 +1,242 @@
+#pragma once
+
+#ifndef PARTITION_OF_UNITY_H
+#define PARTITION_OF_UNITY_H
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "ImplicitSurface.h"
+#include "SpatialIndex.h"
+#include "Parallel.h"
+
+//! Partition of unity RBF reconstruction for large point clouds.
+//! The bounding cube of the points is subdivided adaptively by an octree until every leaf holds at most maxPointsPerCell points.
+//! Each leaf cell gets a spherical support around its center (overlap times the radius of the cell) and a small RBF that is
+//! fitted independently to the points inside this support, so the reconstruction is linear in the number of points and the
+//! local fits run in parallel. The local fits are blended with smooth weights  w_i(x) = W(|x - c_i| / r_i)  (Wendland C2),
+//! f(x) = sum_i w_i(x) f_i(x) / sum_i w_i(x). Since the supports cover their cells, the weights sum up to a positive value
+//! everywhere inside the cube. Cells with too few points in their support fall back to the signed distance to the tangent plane
+//! of the nearest input point (as in Hoppe). Outside of the cube, the field is blended smoothly into this distance where the sum of
+//! the weights falls below the smallest sum inside the cube, so that it stays continuous at the border of the supports.
+class PartitionOfUnityRBF : public ImplicitSurface
+{
+public:
+	//! options.verbose prints the progress of the whole reconstruction, the local fits are always silent.
+	PartitionOfUnityRBF(const std::string& filenamePC, unsigned int maxPointsPerCell = 64, double overlap = 1.25, const RBFOptions& options = RBFOptions())
+		: m_maxPointsPerCell(maxPointsPerCell), m_overlap(overlap), m_options(options), m_verbose(options.verbose)
+	{
+		// every point of the cube is within radius / overlap of the center of its leaf cell (bounded if the overlap is too small)
+		m_minSumWeights = Weight(std::min(1.0 / m_overlap, 0.9));
+
+		// the progress of thousands of local solves is not of interest, and neither are their coefficients worth a cache blob each
+		m_options.verbose = false;
+		m_options.cacheDirectory.clear();
+
+		// load point cloud
+		PointCloud pointcloud;
+		pointcloud.ReadFromFile(filenamePC);
+		for (unsigned int i = 0; i < pointcloud.GetPoints().size(); i++)
+		{
+			m_points.push_back(pointcloud.GetPoints()[i].cast<double>());
+			m_normals.push_back(pointcloud.GetNormals()[i].cast<double>());
+		}
+		if (m_points.empty()) return;
+
+		// bounding cube of the points (slightly enlarged)
+		Vector3d bbMin = m_points[0], bbMax = m_points[0];
+		for (const Vector3d& p : m_points)
+		{
+			bbMin = bbMin.cwiseMin(p);
+			bbMax = bbMax.cwiseMax(p);
+		}
+		const Vector3d center = 0.5 * (bbMin + bbMax);
+		const double halfSize = std::max(0.5 * 1.05 * (bbMax - bbMin).maxCoeff(), 1e-6);
+
+		std::vector<unsigned int> order(m_points.size());
+		for (unsigned int i = 0; i < order.size(); ++i) order[i] = i;
+		BuildCells(order, 0, (unsigned int)order.size(), center - Vector3d::Constant(halfSize), center + Vector3d::Constant(halfSize), 0);
+
+		// spatial index over the points, the cell size is about the support radius of the fine cells
+		double meanRadius = 0.0;
+		unsigned int numNonEmpty = 0;
+		for (const Cell& cell : m_cells)
+		{
+			if (!cell.numPoints) continue;
+			meanRadius += cell.radius;
+			numNonEmpty++;
+		}
+		m_pointIndex.Build(m_points, meanRadius / std::max(1u, numNonEmpty));
+
+		if (m_verbose) std::cerr << "Fitting " << m_cells.size() << " local RBFs" << std::endl;
+		ParallelFor(0, m_cells.size(), [&](size_t i) { FitCell(m_cells[i]); });
+
+		// all cells of an octree level have the same support radius -> one grid over the cell centers per level
+		std::vector<std::vector<Vector3d>> centers(m_levelRadius.size());
+		m_levelCells.resize(m_levelRadius.size());
+		for (unsigned int i = 0; i < m_cells.size(); ++i)
+		{
+			m_levelCells[m_cells[i].depth].push_back(i);
+			centers[m_cells[i].depth].push_back(m_cells[i].center);
+		}
+		m_levels.resize(m_levelRadius.size());
+		for (size_t d = 0; d < m_levels.size(); ++d)
+			m_levels[d].Build(centers[d], m_levelRadius[d]);
+
+		if (m_verbose) std::cerr << "Done." << std::endl;
+	}
+
+	double Eval(const Eigen::Vector3d& _x)
+	{
+		if (m_points.empty()) return 0.0;
+
+		double sumWeights = 0.0, result = 0.0;
+		for (size_t d = 0; d < m_levels.size(); ++d)
+		{
+			const double radius = m_levelRadius[d];
+			m_levels[d].ForEachInRadius(_x, radius, [&](unsigned int i, double d2) {
+				const double t = sqrt(d2) / radius;
+				if (t >= 1.0) return;
+				const double w = Weight(t);
+				sumWeights += w;
+				result += w * EvalCell(m_cells[m_levelCells[d][i]], _x);
+			});
+		}
+		if (sumWeights >= m_minSumWeights)
+			return result / sumWeights;
+
+		// outside of the cube: blend into the tangent plane distance, which is used alone outside of all supports
+		const int idx = m_pointIndex.Nearest(_x);
+		const double planeDist = (_x - m_points[idx]).dot(m_normals[idx]);
+		if (sumWeights <= 0.0) return planeDist;
+
+		const double t = sumWeights / m_minSumWeights;
+		const double w = t * t * (3.0 - 2.0 * t);
+		return w * result / sumWeights + (1.0 - w) * planeDist;
+	}
+
+	//! Number of leaf cells (= local fits).
+	size_t GetNumCells() const { return m_cells.size(); }
+
+private:
+
+	struct Cell
+	{
+		//! Center and support radius of the cell.
+		Vector3d center;
+		double radius;
+		unsigned int depth;
+
+		//! Number of points inside the (unenlarged) cell.
+		unsigned int numPoints;
+
+		//! Local fit, nullptr if there are too few points in the support: then the tangent plane (point, normal) is used.
+		std::unique_ptr<RBF> fit;
+		Vector3d planePoint, planeNormal;
+	};
+
+	//! Smooth weight of a cell at the normalized distance t in [0, 1) to its center.
+	static double Weight(double t)
+	{
+		const double a = 1.0 - t;
+		return a * a * a * a * (4.0 * t + 1.0);
+	}
+
+	double EvalCell(Cell& cell, const Vector3d& x) const
+	{
+		if (cell.fit) return cell.fit->Eval(x);
+		return (x - cell.planePoint).dot(cell.planeNormal);
+	}
+
+	//! Subdivides the box [bbMin, bbMax] with the points order[begin..end) until a cell holds at most m_maxPointsPerCell points.
+	//! Empty octants become leaves as well, so that the leaves tile the whole cube.
+	void BuildCells(std::vector<unsigned int>& order, unsigned int begin, unsigned int end, const Vector3d& bbMin, const Vector3d& bbMax, unsigned int depth)
+	{
+		const Vector3d mid = 0.5 * (bbMin + bbMax);
+
+		if (end - begin <= m_maxPointsPerCell || depth >= kMaxDepth)
+		{
+			if (m_levelRadius.size() <= depth)
+				m_levelRadius.resize(depth + 1);
+			m_levelRadius[depth] = m_overlap * 0.5 * (bbMax - bbMin).norm();
+
+			m_cells.emplace_back();
+			Cell& cell = m_cells.back();
+			cell.center = mid;
+			cell.radius = m_levelRadius[depth];
+			cell.depth = depth;
+			cell.numPoints = end - begin;
+			return;
+		}
+
+		// partition the range into the octants of the box
+		auto octant = [&](unsigned int i) {
+			const Vector3d& p = m_points[i];
+			return (p.x() >= mid.x() ? 1 : 0) | (p.y() >= mid.y() ? 2 : 0) | (p.z() >= mid.z() ? 4 : 0);
+		};
+		std::sort(order.begin() + begin, order.begin() + end, [&](unsigned int a, unsigned int b) { return octant(a) < octant(b); });
+
+		for (int o = 0, i = begin; o < 8; ++o)
+		{
+			const unsigned int first = i;
+			while (i < (int)end && octant(order[i]) == o) ++i;
+
+			Vector3d cMin, cMax;
+			for (int k = 0; k < 3; ++k)
+			{
+				cMin[k] = (o >> k) & 1 ? mid[k] : bbMin[k];
+				cMax[k] = (o >> k) & 1 ? bbMax[k] : mid[k];
+			}
+			BuildCells(order, first, i, cMin, cMax, depth + 1);
+		}
+	}
+
+	//! Fits the local RBF of a cell to the points inside its support.
+	void FitCell(Cell& cell) const
+	{
+		std::vector<Vector3d> points, normals;
+		m_pointIndex.ForEachInRadius(cell.center, cell.radius, [&](unsigned int j, double) {
+			points.push_back(m_points[j]);
+			normals.push_back(m_normals[j]);
+		});
+
+		if (points.size() >= kMinPointsPerFit)
+		{
+			cell.fit.reset(new RBF(points, normals, m_options));
+		}
+		else
+		{
+			const int idx = m_pointIndex.Nearest(cell.center);
+			cell.planePoint = m_points[idx];
+			cell.planeNormal = m_normals[idx];
+		}
+	}
+
+	static const unsigned int kMaxDepth = 16;
+
+	//! Minimum number of points for a local RBF fit.
+	static const unsigned int kMinPointsPerFit = 16;
+
+	unsigned int m_maxPointsPerCell;
+	double m_overlap;
+	RBFOptions m_options;
+	bool m_verbose;
+
+	//! Smallest sum of the weights inside the cube, the field is blended into the plane distance below.
+	double m_minSumWeights;
+
+	//! The input points and their normals.
+	std::vector<Vector3d> m_points, m_normals;
+	PointGrid m_pointIndex;
+
+	//! Leaf cells of the octree.
+	std::vector<Cell> m_cells;
+
+	//! Per octree level: support radius of the cells, grid over their centers and the indices of the cells in m_cells.
+	std::vector<double> m_levelRadius;
+	std::vector<PointGrid> m_levels;
+	std::vector<std::vector<unsigned int>> m_levelCells;
+};
+
+#endif // PARTITION_OF_UNITY_H
@@ -0,0 +1,105 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+
+#include "Eigen.h"
+#include "ImplicitSurface.h"
+#include "ScreenedPoisson.h"
+#include "Volume.h"
+#include "VolumeSampler.h"
+
+// Compares the dense RBF with the screened Poisson reconstruction on growing random subsets of a point cloud.
+// Both times include the reconstruction and sampling the volume of main.cpp; the RBF is skipped above maxRBFPoints.
+// usage: poisson_benchmark [point cloud] [max. number of points for the RBF] [depth of the Poisson reconstruction]
+
+static double SecondsSince(const std::chrono::steady_clock::time_point& start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double TimeReconstruction(ImplicitSurface* (*create)(const std::vector<Vector3d>&, const std::vector<Vector3d>&, unsigned int),
+	const std::vector<Vector3d>& points, const std::vector<Vector3d>& normals, unsigned int depth)
+{
+	const auto start = std::chrono::steady_clock::now();
+	ImplicitSurface* surface = create(points, normals, depth);
+
+	unsigned int mc_res = 50;
+	Volume vol(Vector3d(-0.1, -0.1, -0.1), Vector3d(1.1, 1.1, 1.1), mc_res, mc_res, mc_res, 1);
+	SampleVolume(surface, vol);
+
+	delete surface;
+	return SecondsSince(start);
+}
+
+static ImplicitSurface* CreateRBF(const std::vector<Vector3d>& points, const std::vector<Vector3d>& normals, unsigned int)
+{
+	RBFOptions options;
+	options.verbose = false;
+	return new RBF(points, normals, options);
+}
+
+static ImplicitSurface* CreatePoisson(const std::vector<Vector3d>& points, const std::vector<Vector3d>& normals, unsigned int depth)
+{
+	PoissonOptions options;
+	options.depth = depth;
+	options.verbose = false;
+	return new ScreenedPoisson(points, normals, options);
+}
+
+int main(int argc, char** argv)
+{
+	std::string filenameIn = argc > 1 ? argv[1] : "../../Data/normalized.pcb";
+	const unsigned int maxRBFPoints = argc > 2 ? (unsigned int)atoi(argv[2]) : 8000;
+	const unsigned int depth = argc > 3 ? (unsigned int)atoi(argv[3]) : PoissonOptions().depth;
+
+	PointCloud pointcloud;
+	if (!pointcloud.ReadFromFile(filenameIn) || pointcloud.GetPoints().empty())
+	{
+		std::cout << "ERROR: unable to read " << filenameIn << std::endl;
+		return -1;
+	}
+
+	// random order, so that every prefix is a subset that covers the whole surface
+	const unsigned int numPoints = (unsigned int)pointcloud.GetPoints().size();
+	std::vector<unsigned int> order(numPoints);
+	for (unsigned int i = 0; i < numPoints; ++i) order[i] = i;
+	std::shuffle(order.begin(), order.end(), std::mt19937(0));
+
+	std::cout << std::setw(10) << "points" << std::setw(12) << "RBF [s]" << std::setw(14) << "Poisson [s]" << std::endl;
+	unsigned int crossover = 0;
+	for (unsigned int n = std::min(250u, numPoints);; n = std::min(2 * n, numPoints))
+	{
+		std::vector<Vector3d> points(n), normals(n);
+		for (unsigned int i = 0; i < n; ++i)
+		{
+			points[i] = pointcloud.GetPoints()[order[i]].cast<double>();
+			normals[i] = pointcloud.GetNormals()[order[i]].cast<double>();
+		}
+
+		const double timePoisson = TimeReconstruction(CreatePoisson, points, normals, depth);
+		std::cout << std::setw(10) << n;
+		if (n <= maxRBFPoints)
+		{
+			const double timeRBF = TimeReconstruction(CreateRBF, points, normals, depth);
+			if (!crossover && timePoisson < timeRBF) crossover = n;
+			std::cout << std::setw(12) << timeRBF;
+		}
+		else
+		{
+			std::cout << std::setw(12) << "-";
+		}
+		std::cout << std::setw(14) << timePoisson << std::endl;
+
+		if (n == numPoints) break;
+	}
+
+	if (crossover)
+		std::cout << "Screened Poisson is faster from " << crossover << " points on" << std::endl;
+	else
+		std::cout << "RBF is faster for all tested sizes" << std::endl;
+
+	return 0;
+}
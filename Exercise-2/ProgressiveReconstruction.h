@@ -0,0 +1,87 @@
+#pragma once
+
+#ifndef PROGRESSIVE_RECONSTRUCTION_H
+#define PROGRESSIVE_RECONSTRUCTION_H
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "ImplicitSurface.h"
+#include "Volume.h"
+#include "VolumeSampler.h"
+#include "MarchingCubes.h"
+
+struct ProgressiveOptions
+{
+	//! Number of nodes per axis of the first and the last level. Every level doubles the number of cells, n nodes become 2n - 1;
+	//! with 2^k + 1 nodes (16^3 cells for 17), the nodes of a level are exactly the even nodes of the next one.
+	uint startResolution = 17;
+	uint maxResolution = 513;
+
+	//! Wall-clock budget in seconds, for the sampling and the extraction of all levels; <= 0: no budget.
+	double timeBudget = 1.0;
+
+	double iso = 0.0;
+	NarrowBandOptions narrowBand;
+};
+
+//! A level is only extracted if kProgressiveExtractionMargin times the extraction time of the previous level still fits into the
+//! budget. Doubling the resolution gives about 4 times the cells at the surface and thus 4 times the time, the factor 2 on top
+//! is a safety margin for the noise of the timings.
+const double kProgressiveExtractionMargin = 8.0;
+
+//! Called with the mesh of every finished level, its number of nodes per axis and the seconds since the start.
+typedef std::function<void(SimpleMesh&, uint, double)> ProgressiveMeshCallback;
+
+//! Anytime reconstruction: the surface is sampled in a narrow band and extracted with marching cubes at increasing resolutions,
+//! starting at a coarse grid that is finished almost immediately. Every level reuses the evaluated nodes of the previous one, so
+//! the levels together take only a few percent more evaluations than the narrow band of the last one alone, and the meshes are the
+//! same as with SampleVolumeNarrowBand() at their resolution.
+//! When the time budget runs out, the sampling of the current level is cancelled and the mesh of the last finished level is kept;
+//! a level is not extracted either if its extraction would likely exceed the budget (see kProgressiveExtractionMargin).
+//! Every finished mesh is passed to the callback and the last one is returned in mesh.
+//! Returns the number of nodes per axis of the returned mesh, 0 if no level was finished.
+template<typename T = double>
+inline uint ReconstructProgressive(ImplicitSurface* surface, const Vector3d& min, const Vector3d& max, SimpleMesh* mesh,
+	const ProgressiveMeshCallback& callback = ProgressiveMeshCallback(), const ProgressiveOptions& options = ProgressiveOptions())
+{
+	typedef std::chrono::steady_clock Clock;
+	const Clock::time_point start = Clock::now();
+	auto secondsSinceStart = [&]() { return std::chrono::duration<double>(Clock::now() - start).count(); };
+	auto expired = [&]() { return options.timeBudget > 0.0 && secondsSinceStart() >= options.timeBudget; };
+
+	NarrowBandOptions narrowBand = options.narrowBand;
+	narrowBand.cancel = [&]() { return expired() || (options.narrowBand.cancel && options.narrowBand.cancel()); };
+
+	std::unique_ptr<VolumeT<T>> coarser;
+	std::vector<bool> evaluated;
+	double extractionSeconds = 0.0;
+	uint finished = 0;
+	for (uint n = std::max(options.startResolution, 2u); n <= options.maxResolution; n = 2 * n - 1)
+	{
+		std::unique_ptr<VolumeT<T>> vol(new VolumeT<T>(min, max, n, n, n, 1));
+		SampleVolumeNarrowBand(surface, *vol, options.iso, narrowBand, coarser.get(), &evaluated);
+
+		// a cancelled sampling leaves the nodes of the previous level in evaluated
+		if (evaluated.size() != (size_t)n * n * n) break;
+
+		// the extraction is not cancelled, skip it if it would not finish in time
+		const double sampled = secondsSinceStart();
+		if (options.timeBudget > 0.0 && finished > 0 && sampled + kProgressiveExtractionMargin * extractionSeconds > options.timeBudget) break;
+
+		SimpleMesh levelMesh;
+		ExtractIsoSurfaceParallel(vol.get(), options.iso, &levelMesh);
+		extractionSeconds = secondsSinceStart() - sampled;
+
+		*mesh = std::move(levelMesh);
+		finished = n;
+		if (callback) callback(*mesh, n, secondsSinceStart());
+
+		coarser = std::move(vol);
+	}
+	return finished;
+}
+
+#endif // PROGRESSIVE_RECONSTRUCTION_H
@@ -0,0 +1,263 @@
+#pragma once
+
+#ifndef RBF_SOLVER_H
+#define RBF_SOLVER_H
+
+#include <iostream>
+
+#include "Eigen.h"
+#include "Parallel.h"
+
+//! Solvers for the symmetric positive definite normal equations  (A^T A + lambda^2 I) x = A^T b  of the RBF fit.
+//! All of them work in double precision: the smallest eigenvalue of the system is lambda^2, so with the default lambda = 1e-4 the
+//! condition number is about 1e11 - 1e12 (also after a Jacobi scaling), far beyond what a single precision factorization resolves.
+enum class RBFSolverType
+{
+	Auto,              //!< chosen by problem size, see SelectSolver()
+	LLT,               //!< Eigen's dense Cholesky factorization
+	LDLT,              //!< Eigen's dense LDL^T factorization with pivoting (robust for nearly singular systems)
+	BlockedCholesky,   //!< right-looking blocked Cholesky factorization with parallel trailing updates
+	ConjugateGradient  //!< Jacobi-preconditioned CG, the system matrix is never formed
+};
+
+//! Problem sizes (number of unknowns) up to which the automatic selection uses the respective solver.
+const unsigned int kMaxDimSerialCholesky = 2000;
+const unsigned int kMaxDimDenseCholesky = 20000;
+
+//! Resolves RBFSolverType::Auto for a system with dim unknowns.
+inline RBFSolverType SelectSolver(RBFSolverType type, unsigned int dim)
+{
+	if (type != RBFSolverType::Auto) return type;
+	if (dim <= kMaxDimSerialCholesky) return RBFSolverType::LLT;
+	if (dim <= kMaxDimDenseCholesky) return RBFSolverType::BlockedCholesky;
+	return RBFSolverType::ConjugateGradient;
+}
+
+//! Factorizes the lower triangle of the SPD matrix S in place (S = L L^T), the upper triangle is not referenced.
+//! The diagonal blocks are factorized with Eigen's LLT, the panel solves and the trailing updates are distributed over all threads.
+//! Works for double and single precision matrices.
+template<typename Matrix>
+bool BlockedCholeskyInPlace(Matrix& S, Eigen::Index blockSize = 256)
+{
+	const Eigen::Index n = S.rows();
+
+	for (Eigen::Index k = 0; k < n; k += blockSize)
+	{
+		const Eigen::Index kb = std::min(blockSize, n - k);
+		const Eigen::Index m = n - k - kb;
+
+		// diagonal block
+		Eigen::Ref<Matrix> A11 = S.block(k, k, kb, kb);
+		Eigen::LLT<Eigen::Ref<Matrix>, Eigen::Lower> llt(A11);
+		if (llt.info() != Eigen::Success)
+			return false;
+		if (m == 0) break;
+
+		// panel: A21 = A21 * L11^-T
+		const Eigen::Index numRowBlocks = (m + blockSize - 1) / blockSize;
+		ParallelFor(0, numRowBlocks, [&](size_t b) {
+			const Eigen::Index r0 = k + kb + b * blockSize;
+			const Eigen::Index nr = std::min(blockSize, n - r0);
+			S.block(k, k, kb, kb).template triangularView<Eigen::Lower>().transpose().template solveInPlace<Eigen::OnTheRight>(S.block(r0, k, nr, kb));
+		});
+
+		// trailing update of the lower triangle: A22 -= A21 A21^T, one column panel per task
+		const auto A21 = S.block(k + kb, k, m, kb);
+		ParallelFor(0, numRowBlocks, [&](size_t b) {
+			const Eigen::Index c0 = b * blockSize;
+			const Eigen::Index nc = std::min(blockSize, m - c0);
+			S.block(k + kb + c0, k + kb + c0, m - c0, nc).noalias() -= A21.middleRows(c0, m - c0) * A21.middleRows(c0, nc).transpose();
+		});
+	}
+
+	return true;
+}
+
+//! Solves S x = b with a dense factorization of the SPD matrix S (only the lower triangle is used).
+//! S is overwritten by its factor to avoid a second n x n matrix. Returns false if the factorization failed,
+//! e.g. because S is numerically not positive definite (in this case S has to be rebuilt, LDLT is the robust choice).
+inline bool SolveDenseSPD(MatrixXd& S, const VectorXd& b, VectorXd& x, RBFSolverType type, bool verbose = true)
+{
+	if (type == RBFSolverType::LDLT)
+	{
+		if (verbose) std::cerr << "Computing LDLT..." << std::endl;
+		Eigen::LDLT<Eigen::Ref<MatrixXd>, Eigen::Lower> ldlt(S);
+		if (ldlt.info() != Eigen::Success) return false;
+		x = ldlt.solve(b);
+		return true;
+	}
+
+	if (type == RBFSolverType::BlockedCholesky)
+	{
+		if (verbose) std::cerr << "Computing blocked Cholesky..." << std::endl;
+		if (!BlockedCholeskyInPlace(S)) return false;
+		x = S.triangularView<Eigen::Lower>().solve(b);
+		S.triangularView<Eigen::Lower>().transpose().solveInPlace(x);
+		return true;
+	}
+
+	if (verbose) std::cerr << "Computing LLT..." << std::endl;
+	Eigen::LLT<Eigen::Ref<MatrixXd>, Eigen::Lower> llt(S);
+	if (llt.info() != Eigen::Success) return false;
+	x = llt.solve(b);
+	return true;
+}
+
+//! Jacobi-preconditioned conjugate gradients for S x = b, where S is only available through applyS(v, result) = S v.
+//! x is used as initial guess. Returns the number of iterations.
+template<typename Operator>
+int SolveConjugateGradient(const Operator& applyS, const VectorXd& diagonal, const VectorXd& b, VectorXd& x, double tolerance, int maxIterations, bool verbose = true)
+{
+	const VectorXd invDiag = diagonal.cwiseInverse();
+	const double bNorm = b.norm();
+	if (bNorm == 0.0)
+	{
+		x.setZero();
+		return 0;
+	}
+
+	VectorXd Sx(b.size());
+	applyS(x, Sx);
+	VectorXd r = b - Sx;
+	VectorXd z = invDiag.cwiseProduct(r);
+	VectorXd p = z;
+	double rz = r.dot(z);
+
+	int it = 0;
+	for (; it < maxIterations && r.norm() > tolerance * bNorm; ++it)
+	{
+		VectorXd Sp(b.size());
+		applyS(p, Sp);
+		const double alpha = rz / p.dot(Sp);
+		x += alpha * p;
+		r -= alpha * Sp;
+		z = invDiag.cwiseProduct(r);
+		const double rzNew = r.dot(z);
+		p = z + (rzNew / rz) * p;
+		rz = rzNew;
+	}
+
+	if (verbose) std::cerr << "CG: " << it << " iterations, relative residual " << r.norm() / bNorm << std::endl;
+	return it;
+}
+
+//! Cholesky factor S = L L^T of an SPD matrix that is updated when S changes instead of being recomputed:
+//! rank-k updates S + V V^T cost O(n^2 k) and bordering S with k new rows and columns costs O(n^2 k).
+//! The factor is stored in a matrix with spare capacity, so that growing it does not copy it every time.
+class IncrementalCholesky
+{
+public:
+
+	IncrementalCholesky() : m_size(0) {}
+
+	//! Factorizes S (only the lower triangle is used).
+	bool Compute(const MatrixXd& S)
+	{
+		m_size = 0;
+		return Extend(MatrixXd(0, S.cols()), S);
+	}
+
+	//! Updates the factor to S + V V^T, i.e. one rank-1 update (a sequence of Givens-like rotations) per column of V.
+	//! The rotations are blocked: they are computed for a panel of columns of the factor from the rows of the panel, then
+	//! applied to the rows below the panel in tiles, so that a tile of the factor and of V stays in the cache for all of them.
+	void RankUpdate(MatrixXd V)
+	{
+		const Eigen::Index panelSize = 32, tileSize = 256;
+		const Eigen::Index numVectors = V.cols();
+		MatrixXd cosines(panelSize, numVectors), sines(panelSize, numVectors);
+
+		for (Eigen::Index k0 = 0; k0 < m_size; k0 += panelSize)
+		{
+			const Eigen::Index k1 = std::min(k0 + panelSize, m_size);
+
+			// rotations of the panel columns, applied to the rows of the panel
+			for (Eigen::Index k = k0; k < k1; ++k)
+			{
+				for (Eigen::Index j = 0; j < numVectors; ++j)
+				{
+					const double lkk = m_L(k, k);
+					const double r = sqrt(lkk * lkk + V(k, j) * V(k, j));
+					const double c = r / lkk, s = V(k, j) / lkk;
+					m_L(k, k) = r;
+					cosines(k - k0, j) = c;
+					sines(k - k0, j) = s;
+
+					ApplyRotation(m_L.col(k).segment(k + 1, k1 - k - 1), V.col(j).segment(k + 1, k1 - k - 1), c, s);
+				}
+			}
+
+			// the same rotations for the rows below the panel, one tile of rows per task
+			const Eigen::Index numTiles = (m_size - k1 + tileSize - 1) / tileSize;
+			ParallelFor(0, numTiles, [&](size_t t) {
+				const Eigen::Index r0 = k1 + t * tileSize;
+				const Eigen::Index nr = std::min(tileSize, m_size - r0);
+				for (Eigen::Index k = k0; k < k1; ++k)
+					for (Eigen::Index j = 0; j < numVectors; ++j)
+						ApplyRotation(m_L.col(k).segment(r0, nr), V.col(j).segment(r0, nr), cosines(k - k0, j), sines(k - k0, j));
+			});
+		}
+	}
+
+	//! Borders S with new rows and columns:  S <- [S B; B^T C]  (B is n x k, C is k x k, only its lower triangle is used).
+	//! Returns false (and leaves the factor unchanged) if the extended matrix is not positive definite.
+	bool Extend(const MatrixXd& B, const MatrixXd& C)
+	{
+		const Eigen::Index n = m_size, k = C.rows();
+		Reserve(n + k);
+
+		// L21 = B^T L11^-T,  L22 L22^T = C - L21 L21^T
+		auto L21 = m_L.block(n, 0, k, n);
+		auto L22 = m_L.block(n, n, k, k);
+		L22.triangularView<Eigen::Lower>() = C;
+		if (n > 0)
+		{
+			L21 = B.transpose();
+			m_L.topLeftCorner(n, n).triangularView<Eigen::Lower>().solveInPlace(L21.transpose());
+			L22.selfadjointView<Eigen::Lower>().rankUpdate(L21, -1.0);
+		}
+		Eigen::LLT<Eigen::Ref<MatrixXd>, Eigen::Lower> llt(L22);
+		if (llt.info() != Eigen::Success) return false;
+		L22.triangularView<Eigen::StrictlyUpper>().setZero();
+
+		m_size = n + k;
+		return true;
+	}
+
+	//! Solves S x = b.
+	VectorXd Solve(const VectorXd& b) const
+	{
+		const auto L = m_L.topLeftCorner(m_size, m_size);
+		VectorXd x = L.triangularView<Eigen::Lower>().solve(b);
+		L.triangularView<Eigen::Lower>().transpose().solveInPlace(x);
+		return x;
+	}
+
+	Eigen::Index GetSize() const { return m_size; }
+
+private:
+
+	//! One step of a rank-1 update for a part of a column l of the factor and the same part of the update vector v.
+	template<typename Segment>
+	static void ApplyRotation(Segment l, Segment v, double c, double s)
+	{
+		l = (l + s * v) * (1.0 / c);
+		v = c * v - s * l;
+	}
+
+	//! Grows the storage geometrically.
+	void Reserve(Eigen::Index size)
+	{
+		if (size <= m_L.rows()) return;
+
+		const Eigen::Index capacity = std::max(size, m_L.rows() + m_L.rows() / 4);
+		MatrixXd L(capacity, capacity);
+		L.topLeftCorner(m_size, m_size) = m_L.topLeftCorner(m_size, m_size);
+		m_L.swap(L);
+	}
+
+	//! The factor is the lower triangle of the leading m_size x m_size block.
+	MatrixXd m_L;
+	Eigen::Index m_size;
+};
+
+#endif // RBF_SOLVER_H
@@ -0,0 +1,242 @@
+#pragma once
+
+#ifndef RBF_TREECODE_H
+#define RBF_TREECODE_H
+
+#include <vector>
+#include <algorithm>
+
+#include "Eigen.h"
+
+//! Approximate evaluation of a sum of cubic kernels  f(x) = sum_j w_j ||x - c_j||^3  (Barnes-Hut style treecode).
+//! The centers are clustered in an octree. For clusters that are far enough from the query point, the kernels are replaced by
+//! a third order Taylor expansion of r^3 around the cluster center (moments up to order 3), near clusters are summed exactly.
+//! The truncation error of the expansion of a cluster is bounded by 3/8 * sum_j |w_j| |d_j|^4 / (r - s), where d_j = c_j - center,
+//! s = max_j |d_j| and r is the distance of the query point to the cluster center. A cluster is approximated only if this bound
+//! is below its share of the tolerance (proportional to its absolute weight), hence the total error is below the given tolerance.
+class RBFTreecode
+{
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	RBFTreecode(const Eigen::ArrayXd& x, const Eigen::ArrayXd& y, const Eigen::ArrayXd& z, const Eigen::ArrayXd& w, double tolerance, unsigned int leafSize = 32)
+		: m_tolerance(tolerance), m_leafSize(leafSize)
+	{
+		const unsigned int n = (unsigned int)x.size();
+		std::vector<unsigned int> order(n);
+		for (unsigned int i = 0; i < n; ++i) order[i] = i;
+
+		m_nodes.reserve(2 * n / m_leafSize + 1);
+		if (n > 0)
+		{
+			Eigen::Vector3d bbMin(x.minCoeff(), y.minCoeff(), z.minCoeff());
+			Eigen::Vector3d bbMax(x.maxCoeff(), y.maxCoeff(), z.maxCoeff());
+			m_nodes.resize(1);
+			BuildNode(x, y, z, order, 0, 0, n, bbMin, bbMax, 0);
+		}
+
+		// store the centers in tree order, so that every node covers a contiguous range
+		m_x.resize(n); m_y.resize(n); m_z.resize(n); m_w.resize(n);
+		for (unsigned int i = 0; i < n; ++i)
+		{
+			m_x[i] = x[order[i]];
+			m_y[i] = y[order[i]];
+			m_z[i] = z[order[i]];
+			m_w[i] = w[order[i]];
+		}
+
+		for (size_t i = 0; i < m_nodes.size(); ++i)
+			ComputeMoments(m_nodes[i]);
+
+		m_totalAbsWeight = m_w.abs().sum();
+	}
+
+	//! Evaluates the kernel sum at the point p.
+	double Eval(const Eigen::Vector3d& p) const
+	{
+		if (m_nodes.empty()) return 0.0;
+
+		const double relTolerance = m_totalAbsWeight > 0.0 ? m_tolerance / m_totalAbsWeight : 0.0;
+
+		double result = 0.0;
+		unsigned int stack[kMaxDepth * 8 + 8];
+		int top = 0;
+		stack[top++] = 0;
+
+		while (top > 0)
+		{
+			const Node& node = m_nodes[stack[--top]];
+
+			const Eigen::Vector3d R = p - node.center;
+			const double r = R.norm();
+			if (r > 2.0 * node.radius && 0.375 * node.absMoment4 <= relTolerance * node.absWeight * (r - node.radius))
+			{
+				result += EvalExpansion(node, R, r);
+			}
+			else if (node.firstChild < 0)
+			{
+				const unsigned int b = node.begin, e = node.end;
+				result += (m_w.segment(b, e - b) * ((m_x.segment(b, e - b) - p.x()).square() + (m_y.segment(b, e - b) - p.y()).square() + (m_z.segment(b, e - b) - p.z()).square()).sqrt().cube()).sum();
+			}
+			else
+			{
+				for (int c = 0; c < node.numChildren; ++c)
+					stack[top++] = node.firstChild + c;
+			}
+		}
+
+		return result;
+	}
+
+	//! Number of octree nodes.
+	size_t GetNumNodes() const { return m_nodes.size(); }
+
+private:
+
+	static const unsigned int kMaxDepth = 32;
+
+	struct Node
+	{
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		//! Range of centers (in tree order) covered by this node.
+		unsigned int begin, end;
+		//! Children are stored consecutively, firstChild < 0 for leaves.
+		int firstChild;
+		int numChildren;
+
+		//! Expansion center and radius of the cluster around it.
+		Eigen::Vector3d center;
+		double radius;
+
+		//! Moments: sum w, sum w d, sum w d d^T, sum w |d|^2 d, sum w d_i d_j d_k (10 unique entries, see EvalExpansion()).
+		double m0;
+		Eigen::Vector3d m1;
+		Eigen::Matrix3d m2;
+		Eigen::Vector3d m2d;
+		double m3[10];
+
+		//! sum |w|, sum |w| |d|^4 (for the error bound).
+		double absWeight;
+		double absMoment4;
+	};
+
+	//! Fills the node at idx with the centers order[begin..end) inside the box [bbMin, bbMax] and subdivides it recursively.
+	void BuildNode(const Eigen::ArrayXd& x, const Eigen::ArrayXd& y, const Eigen::ArrayXd& z, std::vector<unsigned int>& order,
+		size_t idx, unsigned int begin, unsigned int end, const Eigen::Vector3d& bbMin, const Eigen::Vector3d& bbMax, unsigned int depth)
+	{
+		const Eigen::Vector3d mid = 0.5 * (bbMin + bbMax);
+		m_nodes[idx].begin = begin;
+		m_nodes[idx].end = end;
+		m_nodes[idx].firstChild = -1;
+		m_nodes[idx].numChildren = 0;
+		m_nodes[idx].center = mid;
+
+		if (end - begin <= m_leafSize || depth >= kMaxDepth)
+			return;
+
+		// partition the range into the octants of the box
+		auto octant = [&](unsigned int i) {
+			return (x[i] >= mid.x() ? 1 : 0) | (y[i] >= mid.y() ? 2 : 0) | (z[i] >= mid.z() ? 4 : 0);
+		};
+		std::sort(order.begin() + begin, order.begin() + end, [&](unsigned int a, unsigned int b) { return octant(a) < octant(b); });
+
+		unsigned int bounds[9];
+		bounds[0] = begin;
+		for (int o = 0, i = begin; o < 8; ++o)
+		{
+			while (i < (int)end && octant(order[i]) == o) ++i;
+			bounds[o + 1] = i;
+		}
+
+		// the (non-empty) children of a node are stored consecutively
+		int numChildren = 0;
+		for (int o = 0; o < 8; ++o)
+			if (bounds[o + 1] > bounds[o]) numChildren++;
+
+		const size_t firstChild = m_nodes.size();
+		m_nodes.resize(firstChild + numChildren);
+		m_nodes[idx].firstChild = (int)firstChild;
+		m_nodes[idx].numChildren = numChildren;
+
+		size_t child = firstChild;
+		for (int o = 0; o < 8; ++o)
+		{
+			if (bounds[o + 1] == bounds[o]) continue;
+
+			Eigen::Vector3d cMin, cMax;
+			for (int k = 0; k < 3; ++k)
+			{
+				cMin[k] = (o >> k) & 1 ? mid[k] : bbMin[k];
+				cMax[k] = (o >> k) & 1 ? bbMax[k] : mid[k];
+			}
+			BuildNode(x, y, z, order, child++, bounds[o], bounds[o + 1], cMin, cMax, depth + 1);
+		}
+	}
+
+	void ComputeMoments(Node& node) const
+	{
+		node.m0 = 0.0;
+		node.m1.setZero();
+		node.m2.setZero();
+		node.m2d.setZero();
+		std::fill(node.m3, node.m3 + 10, 0.0);
+		node.absWeight = 0.0;
+		node.absMoment4 = 0.0;
+		node.radius = 0.0;
+
+		for (unsigned int i = node.begin; i < node.end; ++i)
+		{
+			const Eigen::Vector3d d = Eigen::Vector3d(m_x[i], m_y[i], m_z[i]) - node.center;
+			const double w = m_w[i];
+			const double d2 = d.squaredNorm();
+
+			node.m0 += w;
+			node.m1 += w * d;
+			node.m2 += w * d * d.transpose();
+			node.m2d += w * d2 * d;
+
+			node.m3[0] += w * d.x() * d.x() * d.x();
+			node.m3[1] += w * d.y() * d.y() * d.y();
+			node.m3[2] += w * d.z() * d.z() * d.z();
+			node.m3[3] += w * d.x() * d.x() * d.y();
+			node.m3[4] += w * d.x() * d.x() * d.z();
+			node.m3[5] += w * d.x() * d.y() * d.y();
+			node.m3[6] += w * d.y() * d.y() * d.z();
+			node.m3[7] += w * d.x() * d.z() * d.z();
+			node.m3[8] += w * d.y() * d.z() * d.z();
+			node.m3[9] += w * d.x() * d.y() * d.z();
+
+			node.absWeight += fabs(w);
+			node.absMoment4 += fabs(w) * d2 * d2;
+			node.radius = std::max(node.radius, sqrt(d2));
+		}
+	}
+
+	//! Taylor expansion of sum_j w_j ||R - d_j||^3 around d = 0 up to third order.
+	static double EvalExpansion(const Node& node, const Eigen::Vector3d& R, double r)
+	{
+		const double x = R.x(), y = R.y(), z = R.z();
+		const double m3RRR = node.m3[0] * x * x * x + node.m3[1] * y * y * y + node.m3[2] * z * z * z
+			+ 3.0 * (node.m3[3] * x * x * y + node.m3[4] * x * x * z + node.m3[5] * x * y * y
+			+ node.m3[6] * y * y * z + node.m3[7] * x * z * z + node.m3[8] * y * z * z)
+			+ 6.0 * node.m3[9] * x * y * z;
+
+		double result = node.m0 * r * r * r;
+		result -= 3.0 * r * R.dot(node.m1);
+		result += 1.5 * (r * node.m2.trace() + R.dot(node.m2 * R) / r);
+		result -= (9.0 * R.dot(node.m2d) / r - 3.0 * m3RRR / (r * r * r)) / 6.0;
+		return result;
+	}
+
+	double m_tolerance;
+	unsigned int m_leafSize;
+	double m_totalAbsWeight;
+
+	std::vector<Node, Eigen::aligned_allocator<Node>> m_nodes;
+
+	//! Centers and weights in tree order.
+	Eigen::ArrayXd m_x, m_y, m_z, m_w;
+};
+
+#endif // RBF_TREECODE_H
@@ -0,0 +1,408 @@
+#pragma once
+
+#ifndef SCREENED_POISSON_H
+#define SCREENED_POISSON_H
+
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <cstdint>
+
+#include "ImplicitSurface.h"
+#include "Parallel.h"
+
+struct PoissonOptions
+{
+	//! Depth of the finest level: its grid has 2^depth cells along each side of the bounding cube.
+	unsigned int depth = 8;
+
+	//! Levels up to this depth cover the whole cube, the finer ones only a band of cells around the points.
+	unsigned int fullDepth = 5;
+
+	//! Weight alpha of the screening term, which pulls the indicator function to the iso value at the points.
+	double screening = 4.0;
+
+	//! Gauss-Seidel sweeps on the finest level, every coarser level gets twice as many (cascadic multigrid).
+	unsigned int gaussSeidelIterations = 8;
+
+	//! Print the size of the levels to std::cerr.
+	bool verbose = true;
+};
+
+//! Hash of the options that change the reconstruction (not verbose).
+inline uint64_t HashPoissonOptions(const PoissonOptions& options, uint64_t key)
+{
+	key = HashValue(options.depth, key);
+	key = HashValue(options.fullDepth, key);
+	key = HashValue(options.screening, key);
+	return HashValue(options.gaussSeidelIterations, key);
+}
+
+//! Screened Poisson surface reconstruction (Kazhdan and Hoppe 2013) for large oriented point clouds.
+//! The indicator function chi of the solid is the minimizer of  int |grad chi - V|^2 + alpha A sum_p chi(p)^2,  where the vector
+//! field V is made of the normals splatted into the grid (A is the surface area per point). It is discretized with finite
+//! differences on the vertices of a hierarchy of grids that are as fine as an octree of the given depth: the coarse levels are
+//! dense, the finer levels are sparse and only contain the cells within kBandWidth cells of a point (hashed by their
+//! coordinates), so the memory grows with the surface area instead of the volume.
+//! The levels are solved from coarse to fine (cascadic multigrid): every level starts from the interpolated solution of the
+//! coarser ones, which also provides Dirichlet values at the border of the band, and is smoothed with red-black Gauss-Seidel.
+//! The work is linear in the number of points and grid vertices. The result is chi minus its mean value at the points, which is
+//! positive outside (the side the normals point to).
+class ScreenedPoisson : public ImplicitSurface
+{
+public:
+	ScreenedPoisson(const std::string& filenamePC, const PoissonOptions& options = PoissonOptions()) : m_options(options)
+	{
+		// load point cloud
+		PointCloud pointcloud;
+		pointcloud.ReadFromFile(filenamePC);
+
+		std::vector<Vector3d> points, normals;
+		points.reserve(pointcloud.GetPoints().size());
+		normals.reserve(pointcloud.GetPoints().size());
+		for (unsigned int i = 0; i < pointcloud.GetPoints().size(); i++)
+		{
+			points.push_back(pointcloud.GetPoints()[i].cast<double>());
+			normals.push_back(pointcloud.GetNormals()[i].cast<double>());
+		}
+		Reconstruct(points, normals);
+	}
+
+	ScreenedPoisson(const std::vector<Vector3d>& points, const std::vector<Vector3d>& normals, const PoissonOptions& options = PoissonOptions())
+		: m_options(options)
+	{
+		Reconstruct(points, normals);
+	}
+
+	double Eval(const Eigen::Vector3d& _x)
+	{
+		if (m_levels.empty()) return 0.0;
+		return EvalLevels(_x, m_levels.size()) - m_isoValue;
+	}
+
+	//! Number of grid vertices (= unknowns) of all levels.
+	size_t GetNumNodes() const
+	{
+		size_t numNodes = 0;
+		for (const Level& level : m_levels)
+			numNodes += level.coords.size();
+		return numNodes;
+	}
+
+private:
+
+	struct Level
+	{
+		//! The grid has 2^depth cells of size cellSize along each side, full levels contain all of its vertices.
+		unsigned int depth;
+		double cellSize;
+		bool full;
+
+		//! Active vertices: index by key, integer coordinates, the indices of the 6 neighbours along -x, +x, -y, +y, -z, +z (-1 if
+		//! not active) and whether the value is fixed (border of the band).
+		std::unordered_map<uint64_t, unsigned int> vertexIndex;
+		std::vector<Vector3i> coords;
+		std::vector<int> neighbours;
+		std::vector<unsigned char> fixed;
+
+		//! The vertices of both colors of the red-black ordering.
+		std::vector<unsigned int> colors[2];
+
+		//! Values of chi, right hand side and diagonal of the system.
+		VectorXd solution, rhs, diagonal;
+	};
+
+	static inline uint64_t GetKey(const Vector3i& c)
+	{
+		return (uint64_t)c.x() | ((uint64_t)c.y() << 21) | ((uint64_t)c.z() << 42);
+	}
+
+	//! Cell of the level that contains p (clamped to the cube) and the local coordinates of p in it.
+	inline Vector3i GetCell(const Level& level, const Vector3d& p, Vector3d& local) const
+	{
+		const int res = 1 << level.depth;
+		const Vector3d q = ((p - m_origin) / level.cellSize).cwiseMax(0.0).cwiseMin((double)res);
+		const Vector3i c = q.array().floor().cast<int>().min(res - 1);
+		local = q - c.cast<double>();
+		return c;
+	}
+
+	void Reconstruct(const std::vector<Vector3d>& points, const std::vector<Vector3d>& normals)
+	{
+		if (points.empty()) return;
+
+		// bounding cube of the points, enlarged so that the solid is surrounded by empty space
+		Vector3d bbMin = points[0], bbMax = points[0];
+		for (const Vector3d& p : points)
+		{
+			bbMin = bbMin.cwiseMin(p);
+			bbMax = bbMax.cwiseMax(p);
+		}
+		m_size = std::max(kPadding * (bbMax - bbMin).maxCoeff(), 1e-6);
+		m_origin = 0.5 * (bbMin + bbMax) - Vector3d::Constant(0.5 * m_size);
+
+		const unsigned int maxDepth = std::min(m_options.depth, +kMaxDepth);
+		const unsigned int fullDepth = std::min(m_options.fullDepth, maxDepth);
+		const unsigned int minDepth = std::min(+kMinDepth, fullDepth);
+
+		// surface area per point, estimated by the number of occupied cells of the finest level
+		std::unordered_set<uint64_t> occupied;
+		{
+			Level finest;
+			finest.depth = maxDepth;
+			finest.cellSize = m_size / (1 << maxDepth);
+			Vector3d local;
+			for (const Vector3d& p : points)
+				occupied.insert(GetKey(GetCell(finest, p, local)));
+		}
+		const double cellSize = m_size / (1 << maxDepth);
+		const double areaPerPoint = occupied.size() * cellSize * cellSize / points.size();
+
+		m_levels.resize(maxDepth - minDepth + 1);
+		for (size_t l = 0; l < m_levels.size(); ++l)
+		{
+			Level& level = m_levels[l];
+			level.depth = minDepth + (unsigned int)l;
+			level.cellSize = m_size / (1 << level.depth);
+			level.full = level.depth <= fullDepth;
+			BuildLevel(level, points);
+			BuildSystem(level, points, normals, areaPerPoint);
+
+			// cascadic multigrid: interpolate the coarser solution, then smooth
+			if (l == 0)
+			{
+				level.solution = VectorXd::Zero(level.coords.size());
+			}
+			else
+			{
+				level.solution.resize(level.coords.size());
+				ParallelFor(0, (level.coords.size() + kBlockSize - 1) / kBlockSize, [&](size_t blk) {
+					const size_t end = std::min<size_t>(level.coords.size(), (blk + 1) * kBlockSize);
+					for (size_t v = blk * kBlockSize; v < end; ++v)
+						level.solution[v] = EvalLevels(m_origin + level.coords[v].cast<double>() * level.cellSize, l);
+				});
+			}
+			GaussSeidel(level, m_options.gaussSeidelIterations << (m_levels.size() - 1 - l));
+
+			if (m_options.verbose)
+				std::cerr << "Screened Poisson: depth " << level.depth << ", " << level.coords.size() << (level.full ? " vertices" : " vertices in the band") << std::endl;
+		}
+
+		// iso value = mean of chi at the points
+		std::vector<double> values(points.size());
+		ParallelFor(0, (points.size() + kBlockSize - 1) / kBlockSize, [&](size_t blk) {
+			const size_t end = std::min<size_t>(points.size(), (blk + 1) * kBlockSize);
+			for (size_t i = blk * kBlockSize; i < end; ++i)
+				values[i] = EvalLevels(points[i], m_levels.size());
+		});
+		m_isoValue = 0.0;
+		for (double v : values) m_isoValue += v;
+		m_isoValue /= points.size();
+	}
+
+	//! Creates the active vertices of a level: all of them for a full level, otherwise the corners of the cells within kBandWidth
+	//! cells of a point.
+	void BuildLevel(Level& level, const std::vector<Vector3d>& points) const
+	{
+		const int res = 1 << level.depth;
+		std::vector<uint64_t> keys;
+
+		if (level.full)
+		{
+			keys.reserve((size_t)(res + 1) * (res + 1) * (res + 1));
+			for (int z = 0; z <= res; ++z)
+				for (int y = 0; y <= res; ++y)
+					for (int x = 0; x <= res; ++x)
+						keys.push_back(GetKey(Vector3i(x, y, z)));
+		}
+		else
+		{
+			std::unordered_set<uint64_t> occupied;
+			std::vector<Vector3i> occupiedCells;
+			Vector3d local;
+			for (const Vector3d& p : points)
+			{
+				const Vector3i c = GetCell(level, p, local);
+				if (occupied.insert(GetKey(c)).second) occupiedCells.push_back(c);
+			}
+
+			std::unordered_set<uint64_t> band;
+			for (const Vector3i& c : occupiedCells)
+			{
+				const Vector3i c0 = (c.array() - kBandWidth).max(0), c1 = (c.array() + kBandWidth).min(res - 1);
+				for (int z = c0.z(); z <= c1.z(); ++z)
+					for (int y = c0.y(); y <= c1.y(); ++y)
+						for (int x = c0.x(); x <= c1.x(); ++x)
+						{
+							if (!band.insert(GetKey(Vector3i(x, y, z))).second) continue;
+							for (int corner = 0; corner < 8; ++corner)
+								keys.push_back(GetKey(Vector3i(x + (corner & 1), y + ((corner >> 1) & 1), z + (corner >> 2))));
+						}
+			}
+
+			// sorted by key = ordered by z, y, x, which keeps the neighbours close in memory
+			std::sort(keys.begin(), keys.end());
+			keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+		}
+
+		const size_t numVertices = keys.size();
+		const uint64_t mask = (1u << 21) - 1;
+		level.vertexIndex.reserve(numVertices);
+		level.coords.resize(numVertices);
+		for (size_t v = 0; v < numVertices; ++v)
+		{
+			level.vertexIndex[keys[v]] = (unsigned int)v;
+			level.coords[v] = Vector3i((int)(keys[v] & mask), (int)((keys[v] >> 21) & mask), (int)(keys[v] >> 42));
+		}
+
+		level.neighbours.resize(6 * numVertices);
+		level.fixed.resize(numVertices);
+		for (size_t v = 0; v < numVertices; ++v)
+		{
+			bool complete = true;
+			for (int n = 0; n < 6; ++n)
+			{
+				Vector3i c = level.coords[v];
+				c[n / 2] += (n & 1) ? 1 : -1;
+				auto it = (c[n / 2] < 0 || c[n / 2] > res) ? level.vertexIndex.end() : level.vertexIndex.find(GetKey(c));
+				level.neighbours[6 * v + n] = it == level.vertexIndex.end() ? -1 : (int)it->second;
+				complete = complete && it != level.vertexIndex.end();
+			}
+
+			// the border of the band gets its values from the coarser levels, the border of the cube has natural boundary conditions
+			level.fixed[v] = !level.full && !complete;
+			if (!level.fixed[v])
+				level.colors[(level.coords[v].x() + level.coords[v].y() + level.coords[v].z()) & 1].push_back((unsigned int)v);
+		}
+	}
+
+	//! Splats the points into the level (trilinear weights) and sets up the finite difference system of
+	//! E(chi) = sum_edges h (chi_j - chi_i - h V_ij)^2 + alpha A / h sum_v W_v chi_v^2,
+	//! where V_ij is the component of the normal field along the edge and W_v is the splatted point weight of the vertex
+	//! (the screening term is mass lumped). As in the paper, the screening weight grows with the resolution (1 / h ~ 2^depth),
+	//! otherwise it would fade out on the fine levels. Dividing the normal equations by h gives
+	//! (number of neighbours + alpha A W_i / h^2) chi_i - sum_j chi_j = h (sum of incoming V_ij - sum of outgoing V_ij).
+	void BuildSystem(Level& level, const std::vector<Vector3d>& points, const std::vector<Vector3d>& normals, double areaPerPoint) const
+	{
+		const size_t numVertices = level.coords.size();
+		const double h = level.cellSize;
+		std::vector<Vector3d> field(numVertices, Vector3d::Zero());
+		VectorXd weights = VectorXd::Zero(numVertices);
+
+		// the normal field integrates to 1 across the surface: every point covers the area A and is spread over a cell of volume h^3
+		const double fieldScale = areaPerPoint / (h * h * h);
+		for (size_t i = 0; i < points.size(); ++i)
+		{
+			Vector3d local;
+			const Vector3i c = GetCell(level, points[i], local);
+			for (int corner = 0; corner < 8; ++corner)
+			{
+				const Vector3i offset(corner & 1, (corner >> 1) & 1, corner >> 2);
+				const double w = (offset.x() ? local.x() : 1.0 - local.x()) * (offset.y() ? local.y() : 1.0 - local.y()) * (offset.z() ? local.z() : 1.0 - local.z());
+				const unsigned int v = level.vertexIndex.find(GetKey(c + offset))->second;
+				field[v] += w * fieldScale * normals[i];
+				weights[v] += w;
+			}
+		}
+
+		const double screening = m_options.screening * areaPerPoint / (h * h);
+		level.rhs = VectorXd::Zero(numVertices);
+		level.diagonal = screening * weights;
+		for (size_t v = 0; v < numVertices; ++v)
+		{
+			for (int n = 0; n < 6; ++n)
+			{
+				const int j = level.neighbours[6 * v + n];
+				if (j < 0) continue;
+
+				const int axis = n / 2;
+				const double edgeField = 0.5 * (field[v][axis] + field[j][axis]);
+				level.rhs[v] += (n & 1) ? -h * edgeField : h * edgeField;
+				level.diagonal[v] += 1.0;
+			}
+		}
+	}
+
+	//! Red-black Gauss-Seidel: the vertices of one color only depend on the other color, so each half sweep runs in parallel.
+	void GaussSeidel(Level& level, unsigned int iterations) const
+	{
+		for (unsigned int it = 0; it < iterations; ++it)
+		{
+			for (int color = 0; color < 2; ++color)
+			{
+				const std::vector<unsigned int>& vertices = level.colors[color];
+				ParallelFor(0, (vertices.size() + kBlockSize - 1) / kBlockSize, [&](size_t blk) {
+					const size_t end = std::min<size_t>(vertices.size(), (blk + 1) * kBlockSize);
+					for (size_t k = blk * kBlockSize; k < end; ++k)
+					{
+						const unsigned int v = vertices[k];
+						double sum = level.rhs[v];
+						for (int n = 0; n < 6; ++n)
+						{
+							const int j = level.neighbours[6 * v + n];
+							if (j >= 0) sum += level.solution[j];
+						}
+						level.solution[v] = sum / level.diagonal[v];
+					}
+				});
+			}
+		}
+	}
+
+	//! Interpolates chi trilinearly on the finest of the first numLevels levels whose cell around x is active.
+	double EvalLevels(const Vector3d& x, size_t numLevels) const
+	{
+		for (size_t l = numLevels; l-- > 0;)
+		{
+			const Level& level = m_levels[l];
+			Vector3d local;
+			const Vector3i c = GetCell(level, x, local);
+
+			double corners[8];
+			bool active = true;
+			for (int corner = 0; corner < 8 && active; ++corner)
+			{
+				const auto it = level.vertexIndex.find(GetKey(c + Vector3i(corner & 1, (corner >> 1) & 1, corner >> 2)));
+				active = it != level.vertexIndex.end();
+				if (active) corners[corner] = level.solution[it->second];
+			}
+			if (!active) continue;
+
+			const double x00 = corners[0] + local.x() * (corners[1] - corners[0]);
+			const double x10 = corners[2] + local.x() * (corners[3] - corners[2]);
+			const double x01 = corners[4] + local.x() * (corners[5] - corners[4]);
+			const double x11 = corners[6] + local.x() * (corners[7] - corners[6]);
+			const double y0 = x00 + local.y() * (x10 - x00);
+			const double y1 = x01 + local.y() * (x11 - x01);
+			return y0 + local.z() * (y1 - y0);
+		}
+		return 0.0;
+	}
+
+	//! Depth of the coarsest level and maximum depth (21 bits per coordinate of a key).
+	static const unsigned int kMinDepth = 2;
+	static const unsigned int kMaxDepth = 20;
+
+	//! Number of cells around an occupied cell that belong to the band of a sparse level.
+	static const int kBandWidth = 2;
+
+	//! Size of the bounding cube relative to the extent of the points.
+	static constexpr double kPadding = 1.25;
+
+	//! Number of vertices / points per task.
+	static const size_t kBlockSize = 4096;
+
+	PoissonOptions m_options;
+
+	//! Bounding cube.
+	Vector3d m_origin;
+	double m_size;
+
+	//! Levels from coarse to fine.
+	std::vector<Level> m_levels;
+
+	double m_isoValue = 0.0;
+};
+
+#endif // SCREENED_POISSON_H
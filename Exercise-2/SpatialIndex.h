@@ -0,0 +1,284 @@
+#pragma once
+
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#include "Eigen.h"
+
+//! Uniform hash grid over a static set of points for radius and nearest neighbour queries.
+//! Only non-empty cells are stored, so the memory is linear in the number of points independent of the cell size.
+class PointGrid
+{
+public:
+
+	PointGrid() : m_cellSize(1.0) {}
+
+	PointGrid(const std::vector<Vector3d>& points, double cellSize)
+	{
+		Build(points, cellSize);
+	}
+
+	//! Builds the grid; queries are fastest if the cell size is about the query radius.
+	void Build(const std::vector<Vector3d>& points, double cellSize)
+	{
+		m_points = points;
+		m_cellSize = cellSize;
+		m_cells.clear();
+		m_sorted.resize(points.size());
+
+		m_minCell = Vector3i::Constant(std::numeric_limits<int>::max());
+		m_maxCell = Vector3i::Constant(std::numeric_limits<int>::min());
+
+		std::vector<uint64_t> keys(points.size());
+		for (unsigned int i = 0; i < points.size(); ++i)
+		{
+			const Vector3i c = GetCell(points[i]);
+			m_minCell = m_minCell.cwiseMin(c);
+			m_maxCell = m_maxCell.cwiseMax(c);
+			keys[i] = GetKey(c);
+			m_sorted[i] = i;
+		}
+
+		// group the points by cell
+		std::sort(m_sorted.begin(), m_sorted.end(), [&](unsigned int a, unsigned int b) { return keys[a] < keys[b]; });
+		m_cells.reserve(points.size());
+		for (unsigned int i = 0; i < m_sorted.size();)
+		{
+			unsigned int j = i;
+			while (j < m_sorted.size() && keys[m_sorted[j]] == keys[m_sorted[i]]) ++j;
+			m_cells[keys[m_sorted[i]]] = std::make_pair(i, j);
+			i = j;
+		}
+	}
+
+	//! Calls func(index, squaredDistance) for all points within radius of p.
+	template<typename Func>
+	void ForEachInRadius(const Vector3d& p, double radius, const Func& func) const
+	{
+		if (m_points.empty()) return;
+
+		const double r2 = radius * radius;
+		const Vector3i c0 = GetCell(p - Vector3d::Constant(radius)).cwiseMax(m_minCell);
+		const Vector3i c1 = GetCell(p + Vector3d::Constant(radius)).cwiseMin(m_maxCell);
+
+		for (int x = c0.x(); x <= c1.x(); ++x)
+			for (int y = c0.y(); y <= c1.y(); ++y)
+				for (int z = c0.z(); z <= c1.z(); ++z)
+				{
+					const auto it = m_cells.find(GetKey(Vector3i(x, y, z)));
+					if (it == m_cells.end()) continue;
+
+					for (unsigned int k = it->second.first; k < it->second.second; ++k)
+					{
+						const unsigned int idx = m_sorted[k];
+						const double d2 = (m_points[idx] - p).squaredNorm();
+						if (d2 <= r2) func(idx, d2);
+					}
+				}
+	}
+
+	//! Returns the index of the point closest to p (-1 if the grid is empty) and optionally its squared distance.
+	int Nearest(const Vector3d& p, double* squaredDistance = nullptr) const
+	{
+		if (m_points.empty()) return -1;
+
+		const Vector3i c = GetCell(p);
+		int best = -1;
+		double bestD2 = std::numeric_limits<double>::max();
+
+		auto visitCell = [&](int x, int y, int z) {
+			const auto it = m_cells.find(GetKey(Vector3i(x, y, z)));
+			if (it == m_cells.end()) return;
+
+			for (unsigned int k = it->second.first; k < it->second.second; ++k)
+			{
+				const double d2 = (m_points[m_sorted[k]] - p).squaredNorm();
+				if (d2 < bestD2)
+				{
+					bestD2 = d2;
+					best = (int)m_sorted[k];
+				}
+			}
+		};
+
+		// search shells of cells around the cell of p, until no closer point can be found in the next shell
+		const int maxRing = (c - m_minCell).cwiseAbs().cwiseMax((m_maxCell - c).cwiseAbs()).maxCoeff();
+		for (int ring = 0; ring <= maxRing; ++ring)
+		{
+			const int x0 = std::max(c.x() - ring, m_minCell.x()), x1 = std::min(c.x() + ring, m_maxCell.x());
+			const int y0 = std::max(c.y() - ring, m_minCell.y()), y1 = std::min(c.y() + ring, m_maxCell.y());
+			const int z0 = std::max(c.z() - ring, m_minCell.z()), z1 = std::min(c.z() + ring, m_maxCell.z());
+
+			for (int x = x0; x <= x1; ++x)
+				for (int y = y0; y <= y1; ++y)
+				{
+					if (std::abs(x - c.x()) == ring || std::abs(y - c.y()) == ring)
+					{
+						for (int z = z0; z <= z1; ++z) visitCell(x, y, z);
+					}
+					else
+					{
+						// only the two caps of the shell in z-direction
+						if (c.z() - ring >= m_minCell.z()) visitCell(x, y, c.z() - ring);
+						if (c.z() + ring <= m_maxCell.z()) visitCell(x, y, c.z() + ring);
+					}
+				}
+
+			const double ringDist = ring * m_cellSize;
+			if (best >= 0 && bestD2 <= ringDist * ringDist) break;
+		}
+
+		if (squaredDistance) *squaredDistance = bestD2;
+		return best;
+	}
+
+	const std::vector<Vector3d>& GetPoints() const { return m_points; }
+
+	double GetCellSize() const { return m_cellSize; }
+
+private:
+
+	inline Vector3i GetCell(const Vector3d& p) const
+	{
+		return Vector3i((int)floor(p.x() / m_cellSize), (int)floor(p.y() / m_cellSize), (int)floor(p.z() / m_cellSize));
+	}
+
+	//! Packs the cell coordinates into 21 bits each.
+	static inline uint64_t GetKey(const Vector3i& c)
+	{
+		const uint64_t mask = (1u << 21) - 1;
+		return (((uint64_t)c.x() & mask) << 42) | (((uint64_t)c.y() & mask) << 21) | ((uint64_t)c.z() & mask);
+	}
+
+	std::vector<Vector3d> m_points;
+	double m_cellSize;
+
+	//! Point indices sorted by cell, and the range of every non-empty cell in this array.
+	std::vector<unsigned int> m_sorted;
+	std::unordered_map<uint64_t, std::pair<unsigned int, unsigned int>> m_cells;
+
+	//! Bounding box of the non-empty cells.
+	Vector3i m_minCell, m_maxCell;
+};
+
+//! Balanced kd-tree over a static set of points for nearest neighbour queries at any distance from the points, where the rings of
+//! a PointGrid would visit many empty cells. The tree is implicit: the points are reordered such that every range [begin, end) is
+//! split at its median point mid = (begin + end) / 2 along the axis of its largest extent. The axis and the bounding box of the
+//! range are stored at mid; the boxes are tight, which prunes much more than the splitting planes for points on a surface.
+class PointTree
+{
+public:
+
+	void Build(const std::vector<Vector3d>& points)
+	{
+		m_points = points;
+		m_nodes.resize(points.size());
+
+		std::vector<unsigned int> order(points.size());
+		for (unsigned int i = 0; i < order.size(); ++i) order[i] = i;
+		BuildNode(order, 0, (unsigned int)order.size());
+
+		// store the points in tree order, so that the leaves are contiguous in memory
+		m_indices = order;
+		for (unsigned int i = 0; i < order.size(); ++i)
+			m_points[i] = points[order[i]];
+	}
+
+	//! Returns the index of the point closest to p (-1 if the tree is empty) and optionally its squared distance.
+	int Nearest(const Vector3d& p, double* squaredDistance = nullptr) const
+	{
+		if (m_points.empty()) return -1;
+
+		unsigned int best = 0;
+		double bestD2 = std::numeric_limits<double>::max();
+		NearestNode(p, 0, (unsigned int)m_points.size(), best, bestD2);
+
+		if (squaredDistance) *squaredDistance = bestD2;
+		return (int)m_indices[best];
+	}
+
+private:
+
+	struct Node
+	{
+		Vector3d bbMin, bbMax;
+		int axis;
+	};
+
+	void BuildNode(std::vector<unsigned int>& order, unsigned int begin, unsigned int end)
+	{
+		if (end - begin <= kLeafSize) return;
+
+		const unsigned int mid = (begin + end) / 2;
+		Node& node = m_nodes[mid];
+		node.bbMin = node.bbMax = m_points[order[begin]];
+		for (unsigned int i = begin + 1; i < end; ++i)
+		{
+			node.bbMin = node.bbMin.cwiseMin(m_points[order[i]]);
+			node.bbMax = node.bbMax.cwiseMax(m_points[order[i]]);
+		}
+		(node.bbMax - node.bbMin).maxCoeff(&node.axis);
+
+		const int axis = node.axis;
+		std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+			[&](unsigned int a, unsigned int b) { return m_points[a][axis] < m_points[b][axis]; });
+
+		BuildNode(order, begin, mid);
+		BuildNode(order, mid + 1, end);
+	}
+
+	void NearestNode(const Vector3d& p, unsigned int begin, unsigned int end, unsigned int& best, double& bestD2) const
+	{
+		if (end - begin <= kLeafSize)
+		{
+			for (unsigned int i = begin; i < end; ++i)
+			{
+				const double d2 = (m_points[i] - p).squaredNorm();
+				if (d2 < bestD2)
+				{
+					bestD2 = d2;
+					best = i;
+				}
+			}
+			return;
+		}
+
+		const unsigned int mid = (begin + end) / 2;
+		const Node& node = m_nodes[mid];
+		if ((node.bbMin - p).cwiseMax(p - node.bbMax).cwiseMax(0.0).squaredNorm() >= bestD2) return;
+
+		const double d2 = (m_points[mid] - p).squaredNorm();
+		if (d2 < bestD2)
+		{
+			bestD2 = d2;
+			best = mid;
+		}
+
+		// the side of p first, it is more likely to contain the nearest point
+		if (p[node.axis] < m_points[mid][node.axis])
+		{
+			NearestNode(p, begin, mid, best, bestD2);
+			NearestNode(p, mid + 1, end, best, bestD2);
+		}
+		else
+		{
+			NearestNode(p, mid + 1, end, best, bestD2);
+			NearestNode(p, begin, mid, best, bestD2);
+		}
+	}
+
+	static const unsigned int kLeafSize = 8;
+
+	//! The points in tree order, their indices in the input, and the nodes at the medians of the ranges.
+	std::vector<Vector3d> m_points;
+	std::vector<unsigned int> m_indices;
+	std::vector<Node, Eigen::aligned_allocator<Node>> m_nodes;
+};
+
+#endif // SPATIAL_INDEX_H
@@ -0,0 +1,44 @@
+#pragma once
+
+#ifndef SURFACE_FACTORY_H
+#define SURFACE_FACTORY_H
+
+#include <functional>
+#include <string>
+#include <typeinfo>
+
+#include "ImplicitSurface.h"
+#include "ScreenedPoisson.h"
+#include "Cache.h"
+
+//! Constructs an implicit surface on demand and knows the hash of its type and constructor arguments beforehand, so that a
+//! cached result of the surface (e.g. a sampled volume) can be looked up without constructing it, which fits the RBFs.
+struct SurfaceFactory
+{
+	std::function<ImplicitSurface*()> create;
+	uint64_t key;
+};
+
+//! Hashes of the constructor arguments. Strings are the files of point clouds, their content is hashed instead of the name.
+inline uint64_t HashSurfaceArgument(const std::string& filename, uint64_t key) { return HashValue(HashFile(filename), key); }
+inline uint64_t HashSurfaceArgument(const Eigen::Vector3d& v, uint64_t key) { return HashBytes(v.data(), sizeof(v), key); }
+inline uint64_t HashSurfaceArgument(double value, uint64_t key) { return HashValue(value, key); }
+inline uint64_t HashSurfaceArgument(int value, uint64_t key) { return HashValue(value, key); }
+inline uint64_t HashSurfaceArgument(unsigned int value, uint64_t key) { return HashValue(value, key); }
+inline uint64_t HashSurfaceArgument(const RBFOptions& options, uint64_t key) { return HashRBFOptions(options, key); }
+inline uint64_t HashSurfaceArgument(const PoissonOptions& options, uint64_t key) { return HashPoissonOptions(options, key); }
+
+//! Factory of new Surface(args...); the arguments are copied, the point cloud files are read when the key is computed and again
+//! when the surface is created.
+template<typename Surface, typename... Args>
+SurfaceFactory MakeSurfaceFactory(const Args&... args)
+{
+	SurfaceFactory factory;
+	factory.key = HashString(typeid(Surface).name(), HashBytes(nullptr, 0));
+	const int hashed[] = { 0, (factory.key = HashSurfaceArgument(args, factory.key), 0)... };
+	(void)hashed;
+	factory.create = [=]() -> ImplicitSurface* { return new Surface(args...); };
+	return factory;
+}
+
+#endif // SURFACE_FACTORY_H
@@ -0,0 +1,246 @@
+#pragma once
+
+#ifndef SURFACE_NETS_H
+#define SURFACE_NETS_H
+
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+
+#include "ImplicitSurface.h"
+#include "MarchingCubes.h"
+
+//! Step of the central differences for the gradients of dual contouring, relative to the voxel size.
+const double kSNGradientStep = 0.1;
+
+//! Eigenvalues of the QEF below this fraction of the largest one are truncated (flat and smooth regions).
+const double kSNEigenvalueThreshold = 0.1;
+
+//! Edges of a cell: the first corner (bit a of a corner is its offset along the axis a) and the axis of the edge.
+constexpr uint8_t snEdges[12][2] = {
+	{ 0, 0 }, { 2, 0 }, { 4, 0 }, { 6, 0 },
+	{ 0, 1 }, { 1, 1 }, { 4, 1 }, { 5, 1 },
+	{ 0, 2 }, { 1, 2 }, { 2, 2 }, { 3, 2 }
+};
+
+//! Extracts the iso-surface as the dual of the volume's cells (Surface Nets, Gibson), an alternative to marching cubes.
+//! Every cell that is crossed by the surface gets one vertex, and every edge of the volume with a sign change gets a quad that
+//! connects the vertices of its 4 cells, split along its shorter diagonal. Without a surface, the vertex is the mean of the
+//! crossings of the cell's edges (naive Surface Nets). With a surface, it is the minimizer of the quadratic error to the tangent
+//! planes at the crossings, with the normals from central differences of the surface (dual contouring, Ju et al.), which keeps
+//! sharp edges and corners; the solution is regularized towards the mean and clamped to the cell.
+//! The vertices are not tied to the edges of the grid, so there are no slivers. There are about as many vertices and triangles as
+//! in the indexed mesh of ExtractIsoSurface() (one vertex per cell instead of one per edge), a sixth of the vertices of ProcessVolumeCell().
+//! Like ExtractIsoSurface(), the volume is processed per pair of neighbouring yz-slices and the crossings on the slice x + 1 are
+//! handed on to the next pair, and bricks without the iso-surface are skipped. The surface is open at the border of the volume.
+//! Returns the number of triangles.
+template<typename T>
+inline size_t ExtractSurfaceNets(VolumeT<T>* vol, double iso, SimpleMesh* mesh, ImplicitSurface* surface = nullptr)
+{
+	const uint dx = vol->getDimX(), dy = vol->getDimY(), dz = vol->getDimZ();
+	if (dx < 2 || dy < 2 || dz < 2) return 0;
+	vol->updateBrickRanges();
+
+	const size_t sliceSize = (size_t)dy * dz;
+	const size_t layerSize = (size_t)(dy - 1) * (dz - 1);
+	const size_t numTriangles = mesh->GetTriangles().size();
+	const Vector3d voxelSize = vol->pos(1, 1, 1) - vol->pos(0, 0, 0);
+
+	// crossings of the edges with the iso-surface, and their indices (-1: none yet) on the x-edges of the pair and on the
+	// y- and z-edges of both slices
+	std::vector<Vector3d> crossings, normals;
+	std::vector<int> xEdges(sliceSize), yEdges[2], zEdges[2];
+	for (int s = 0; s < 2; ++s)
+	{
+		yEdges[s].assign(sliceSize, -1);
+		zEdges[s].assign(sliceSize, -1);
+	}
+
+	// vertex indices of the cells of the previous and the current layer (-1: no surface in the cell)
+	std::vector<int> cellVertices[2];
+	cellVertices[0].assign(layerSize, -1);
+	cellVertices[1].assign(layerSize, -1);
+
+	// cells of the current layer with a vertex and the range of their crossings in cellCrossings, the quads of the layer
+	std::vector<size_t> surfaceCells, cellCrossingsBegin;
+	std::vector<int> cellCrossings;
+	std::vector<std::array<int, 4>> quads;
+	std::vector<double> xs, ys, zs, vals;
+
+	// values of the two slices (decoded into the buffers unless the volume stores doubles)
+	std::vector<double> buffers[2];
+	vol->adviseSequential(0, 0);
+	const double* slice[2] = { nullptr, vol->getSlice(0, buffers[1]) };
+
+	for (uint x = 0; x + 1 < dx; ++x)
+	{
+		std::swap(buffers[0], buffers[1]);
+		slice[0] = slice[1];
+		vol->adviseSequential(x + 1, 0);
+		slice[1] = vol->getSlice(x + 1, buffers[1]);
+		std::fill(xEdges.begin(), xEdges.end(), -1);
+		std::fill(cellVertices[1].begin(), cellVertices[1].end(), -1);
+		surfaceCells.clear();
+		cellCrossingsBegin.clear();
+		cellCrossings.clear();
+		quads.clear();
+		const size_t firstNew = crossings.size();
+
+		// returns the crossing on an edge, given by its axis, the slice and the coordinates of its first corner
+		auto getCrossing = [&](int axis, int s, uint y, uint z) -> int {
+			const size_t i = (size_t)y * dz + z;
+			int& cached = axis == 0 ? xEdges[i] : (axis == 1 ? yEdges[s][i] : zEdges[s][i]);
+			if (cached >= 0) return cached;
+
+			const size_t j = axis == 0 ? i : (axis == 1 ? i + dz : i + 1);
+			const double v0 = axis == 0 ? slice[0][i] : slice[s][i];
+			const double v1 = axis == 0 ? slice[1][i] : slice[s][j];
+			const uint xSlice = x + (axis == 0 ? 0 : s);
+			const Vector3d p0(vol->posX(xSlice), vol->posY(y), vol->posZ(z));
+			const Vector3d p1(vol->posX(xSlice + (axis == 0)), vol->posY(y + (axis == 1)), vol->posZ(z + (axis == 2)));
+
+			cached = (int)crossings.size();
+			crossings.push_back(VertexInterp(iso, p0, p1, v0, v1));
+			return cached;
+		};
+
+		for (uint y = 0; y + 1 < dy; ++y)
+		{
+			for (uint z = 0; z + 1 < dz; ++z)
+			{
+				// bricks without the iso-surface have no cells with triangles
+				if (!(z & (kVolumeBrickSize - 1)) && vol->isBrickEmpty(x >> kVolumeBrickShift, y >> kVolumeBrickShift, z >> kVolumeBrickShift, iso))
+				{
+					z += kVolumeBrickSize - 1;
+					continue;
+				}
+
+				// corner c is at (x + (c & 1), y + ((c >> 1) & 1), z + (c >> 2)), bit c of the mask is set if it is inside
+				const size_t i = (size_t)y * dz + z;
+				int mask = 0;
+				if (slice[0][i] < iso) mask |= 1;
+				if (slice[1][i] < iso) mask |= 2;
+				if (slice[0][i + dz] < iso) mask |= 4;
+				if (slice[1][i + dz] < iso) mask |= 8;
+				if (slice[0][i + 1] < iso) mask |= 16;
+				if (slice[1][i + 1] < iso) mask |= 32;
+				if (slice[0][i + dz + 1] < iso) mask |= 64;
+				if (slice[1][i + dz + 1] < iso) mask |= 128;
+				if (mask == 0 || mask == 255) continue;
+
+				const size_t cell = (size_t)y * (dz - 1) + z;
+				cellVertices[1][cell] = (int)(mesh->GetVertices().size() + surfaceCells.size());
+				surfaceCells.push_back(cell);
+				cellCrossingsBegin.push_back(cellCrossings.size());
+				for (int e = 0; e < 12; ++e)
+				{
+					const int c = snEdges[e][0], axis = snEdges[e][1];
+					if (((mask >> c) ^ (mask >> (c | (1 << axis)))) & 1)
+						cellCrossings.push_back(getCrossing(axis, c & 1, y + ((c >> 1) & 1), z + (c >> 2)));
+				}
+
+				// the edges at the corner (x, y, z) are shared with cells that already have their vertex: (x, y - 1, z - 1) etc. for
+				// the x-edge, cells of the previous layer for the y- and z-edges; edges on the border of the volume have less than 4 cells
+				auto at = [&](int layer, uint cy, uint cz) { return cellVertices[layer][(size_t)cy * (dz - 1) + cz]; };
+				auto addQuad = [&](int a, int b, int c, int d) {
+					// counter-clockwise around the edge if the corner is inside
+					if (mask & 1) quads.push_back({ { a, b, c, d } });
+					else quads.push_back({ { a, d, c, b } });
+				};
+				if (y > 0 && z > 0 && ((mask ^ (mask >> 1)) & 1))
+					addQuad(at(1, y - 1, z - 1), at(1, y, z - 1), at(1, y, z), at(1, y - 1, z));
+				if (x > 0 && z > 0 && ((mask ^ (mask >> 2)) & 1))
+					addQuad(at(0, y, z - 1), at(0, y, z), at(1, y, z), at(1, y, z - 1));
+				if (x > 0 && y > 0 && ((mask ^ (mask >> 4)) & 1))
+					addQuad(at(0, y - 1, z), at(1, y - 1, z), at(1, y, z), at(0, y, z));
+			}
+		}
+		cellCrossingsBegin.push_back(cellCrossings.size());
+
+		// normals of the new crossings for dual contouring, all central differences of the layer in one batch
+		if (surface)
+		{
+			const size_t numNew = crossings.size() - firstNew;
+			xs.resize(6 * numNew); ys.resize(6 * numNew); zs.resize(6 * numNew); vals.resize(6 * numNew);
+			for (size_t n = 0; n < numNew; ++n)
+				for (int k = 0; k < 6; ++k)
+				{
+					Vector3d p = crossings[firstNew + n];
+					p[k / 2] += (k & 1 ? -kSNGradientStep : kSNGradientStep) * voxelSize[k / 2];
+					xs[6 * n + k] = p.x(); ys[6 * n + k] = p.y(); zs[6 * n + k] = p.z();
+				}
+			surface->EvalBatch(xs.data(), ys.data(), zs.data(), vals.data(), 6 * numNew);
+
+			normals.resize(crossings.size());
+			for (size_t n = 0; n < numNew; ++n)
+			{
+				const Vector3d gradient(vals[6 * n] - vals[6 * n + 1], vals[6 * n + 2] - vals[6 * n + 3], vals[6 * n + 4] - vals[6 * n + 5]);
+				normals[firstNew + n] = gradient.cwiseQuotient(voxelSize).normalized();
+			}
+		}
+
+		// one vertex per cell
+		for (size_t c = 0; c < surfaceCells.size(); ++c)
+		{
+			Vector3d mean(0, 0, 0);
+			for (size_t k = cellCrossingsBegin[c]; k < cellCrossingsBegin[c + 1]; ++k)
+				mean += crossings[cellCrossings[k]];
+			mean /= double(cellCrossingsBegin[c + 1] - cellCrossingsBegin[c]);
+
+			Vector3d position = mean;
+			if (surface)
+			{
+				// minimize sum_k (n_k . (p - c_k))^2 relative to the mean, with the pseudo-inverse of the truncated eigen decomposition
+				Eigen::Matrix3d A = Eigen::Matrix3d::Zero();
+				Vector3d b(0, 0, 0);
+				for (size_t k = cellCrossingsBegin[c]; k < cellCrossingsBegin[c + 1]; ++k)
+				{
+					const Vector3d& n = normals[cellCrossings[k]];
+					A += n * n.transpose();
+					b += n * n.dot(crossings[cellCrossings[k]] - mean);
+				}
+
+				Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigen(A);
+				const Vector3d& lambda = eigen.eigenvalues();
+				Vector3d inverse(0, 0, 0);
+				for (int k = 0; k < 3; ++k)
+					if (lambda[k] > kSNEigenvalueThreshold * lambda[2]) inverse[k] = 1.0 / lambda[k];
+				position += eigen.eigenvectors() * inverse.asDiagonal() * eigen.eigenvectors().transpose() * b;
+
+				const uint y = (uint)(surfaceCells[c] / (dz - 1)), z = (uint)(surfaceCells[c] % (dz - 1));
+				position = position.cwiseMax(vol->pos(x, y, z)).cwiseMin(vol->pos(x + 1, y + 1, z + 1));
+			}
+
+			Vertex vertex = position.cast<float>();
+			mesh->AddVertex(vertex);
+		}
+
+		// two triangles per quad, split along the shorter diagonal
+		const std::vector<Vertex>& vertices = mesh->GetVertices();
+		for (const std::array<int, 4>& q : quads)
+		{
+			if ((vertices[q[0]] - vertices[q[2]]).squaredNorm() <= (vertices[q[1]] - vertices[q[3]]).squaredNorm())
+			{
+				mesh->AddFace(q[0], q[1], q[2]);
+				mesh->AddFace(q[0], q[2], q[3]);
+			}
+			else
+			{
+				mesh->AddFace(q[0], q[1], q[3]);
+				mesh->AddFace(q[1], q[2], q[3]);
+			}
+		}
+
+		// the slice x + 1 is the first slice of the next pair
+		std::swap(yEdges[0], yEdges[1]);
+		std::swap(zEdges[0], zEdges[1]);
+		std::fill(yEdges[1].begin(), yEdges[1].end(), -1);
+		std::fill(zEdges[1].begin(), zEdges[1].end(), -1);
+		std::swap(cellVertices[0], cellVertices[1]);
+	}
+
+	return mesh->GetTriangles().size() - numTriangles;
+}
+
+#endif // SURFACE_NETS_H
@@ -1,7 +1,10 @@
 #include "Volume.h"
+#include "Parallel.h"
 
 //! Initializes an empty volume dataset.
-Volume::Volume(Vector3d min_, Vector3d max_, uint dx_, uint dy_, uint dz_, uint dim)
+template<typename T>
+VolumeT<T>::VolumeT(Vector3d min_, Vector3d max_, uint dx_, uint dy_, uint dz_, uint dim, VolumeLayout layout,
+	const std::string& mappedFile, size_t fileOffset)
 {
 	min = min_;
 	max = max_;
@@ -10,21 +13,61 @@ Volume::Volume(Vector3d min_, Vector3d max_, uint dx_, uint dy_, uint dz_, uint
 	dy = dy_;
 	dz = dz_;
 	m_dim = dim;
+	m_layout = layout;
 	vol = NULL;
 
-	vol = new double[dx*dy*dz];
+	m_numBricks[0] = (dx + kVolumeBrickSize - 1) / kVolumeBrickSize;
+	m_numBricks[1] = (dy + kVolumeBrickSize - 1) / kVolumeBrickSize;
+	m_numBricks[2] = (dz + kVolumeBrickSize - 1) / kVolumeBrickSize;
+	const size_t numBricks = (size_t)m_numBricks[0] * m_numBricks[1] * m_numBricks[2];
+
+	if (m_layout == VolumeLayout::Bricked)
+	{
+		// the bricks are stored in the order of the Morton codes of their coordinates
+		std::vector<std::pair<uint64_t, size_t>> order;
+		order.reserve(numBricks);
+		for (uint bx = 0; bx < m_numBricks[0]; bx++)
+			for (uint by = 0; by < m_numBricks[1]; by++)
+				for (uint bz = 0; bz < m_numBricks[2]; bz++)
+				{
+					const uint64_t code = ((uint64_t)MortonSpread3(bx) << 2) | (MortonSpread3(by) << 1) | MortonSpread3(bz);
+					order.push_back(std::make_pair(code, getBrickIndex(bx, by, bz)));
+				}
+		std::sort(order.begin(), order.end());
+
+		m_brickOffsets.resize(numBricks);
+		for (size_t i = 0; i < numBricks; i++)
+			m_brickOffsets[order[i].second] = i * kVolumeBrickSize * kVolumeBrickSize * kVolumeBrickSize;
+		m_dataSize = numBricks * kVolumeBrickSize * kVolumeBrickSize * kVolumeBrickSize;
+	}
+	else
+	{
+		m_dataSize = (size_t)dx * dy * dz;
+	}
+
+	if (mappedFile.empty())
+	{
+		vol = new T[m_dataSize];
+	}
+	else if (m_file.Open(mappedFile, fileOffset + m_dataSize * sizeof(T)))
+	{
+		vol = (T*)(m_file.GetData() + fileOffset);
+		m_fileOffset = fileOffset;
+	}
 
 	compute_ddx_dddx();
 }
 
-Volume::~Volume()
+template<typename T>
+VolumeT<T>::~VolumeT()
 {
-	delete[] vol;
+	if (!m_file.IsOpen()) delete[] vol;
 };
 
 
 //! Computes spacing in x,y,z-directions.
-void Volume::compute_ddx_dddx()
+template<typename T>
+void VolumeT<T>::compute_ddx_dddx()
 {
 	ddx = 1.0f / (dx - 1);
 	ddy = 1.0f / (dy - 1);
@@ -41,37 +84,287 @@ void Volume::compute_ddx_dddx()
 	}
 
 	diag = max - min;
+
+	// the inverse of the node spacing of pos(), so that sample(pos(x, y, z)) is the value of the node
+	const uint dims[3] = { dx, dy, dz };
+	const double spacing[3] = { ddx, ddy, ddz };
+	for (int a = 0; a < 3; a++)
+		m_invSpacing[a] = dims[a] > 1 && diag[a] > 0 ? 1.0 / (diag[a] * spacing[a]) : 0.0;
 }
 
 //! Zeros out the memory
-void Volume::zeroOutMemory()
+template<typename T>
+void VolumeT<T>::zeroOutMemory()
 {
-	for (uint i1 = 0; i1 < dx*dy*dz; i1++)
-		vol[i1] = double(0);
+	for (size_t i1 = 0; i1 < m_dataSize; i1++)
+		vol[i1] = encode(0.0);
+	m_brickRangesValid = false;
 }
 
 //! Returns the Data.
-double* Volume::getData()
+template<typename T>
+T* VolumeT<T>::getData()
 {
+	m_brickRangesValid = false;
 	return vol;
 };
 
+//! Recomputes the value ranges of the bricks.
+template<typename T>
+void VolumeT<T>::updateBrickRanges()
+{
+	if (m_brickRangesValid) return;
+
+	const size_t numBricks = (size_t)m_numBricks[0] * m_numBricks[1] * m_numBricks[2];
+	m_brickMin.resize(numBricks);
+	m_brickMax.resize(numBricks);
+
+	std::fill(m_brickMin.begin(), m_brickMin.end(), std::numeric_limits<double>::max());
+	std::fill(m_brickMax.begin(), m_brickMax.end(), std::numeric_limits<double>::lowest());
+
+	// the cells of a brick have the nodes of the brick and the first ones of the next bricks, so a node on a brick boundary
+	// belongs to the ranges of the bricks on both sides; the slices are read in memory order of the linear layout
+	const uint mask = kVolumeBrickSize - 1;
+	std::vector<double> buffer;
+	for (uint x = 0; x < dx; x++)
+	{
+		adviseSequential(x, 0);
+		const double* slice = getSlice(x, buffer);
+		const uint bx1 = x >> kVolumeBrickShift, bx0 = (x & mask) || !x ? bx1 : bx1 - 1;
+		for (uint y = 0; y < dy; y++)
+		{
+			const uint by1 = y >> kVolumeBrickShift, by0 = (y & mask) || !y ? by1 : by1 - 1;
+			const double* row = slice + (size_t)y * dz;
+			for (uint bz = 0; bz < m_numBricks[2]; bz++)
+			{
+				const uint z0 = bz << kVolumeBrickShift, z1 = std::min(z0 + kVolumeBrickSize, dz - 1);
+				double minVal = row[z0], maxVal = row[z0];
+				for (uint z = z0 + 1; z <= z1; z++)
+				{
+					minVal = std::min(minVal, row[z]);
+					maxVal = std::max(maxVal, row[z]);
+				}
+
+				for (uint bx = bx0; bx <= bx1 && bx < m_numBricks[0]; bx++)
+					for (uint by = by0; by <= by1 && by < m_numBricks[1]; by++)
+					{
+						const size_t b = getBrickIndex(bx, by, bz);
+						m_brickMin[b] = std::min(m_brickMin[b], minVal);
+						m_brickMax[b] = std::max(m_brickMax[b], maxVal);
+					}
+			}
+		}
+	}
+	m_brickRangesValid = true;
+}
+
+//! Trilinear interpolation of a batch of points, tile by tile.
+template<typename T>
+void VolumeT<T>::sampleBatch(const double* xs, const double* ys, const double* zs, double* out, size_t n) const
+{
+	const double* ps[3] = { xs, ys, zs };
+	SampleTile t[3], c[8];
+	for (size_t first = 0; first < n; first += kVolumeSampleTile)
+	{
+		const size_t count = std::min<size_t>(kVolumeSampleTile, n - first);
+		loadSampleTile(ps, first, count, t, c);
+
+		if (count == kVolumeSampleTile)
+		{
+			Eigen::Map<SampleTile>(out + first) = interpolate(t, c);
+		}
+		else
+		{
+			const SampleTile result = interpolate(t, c);
+			std::copy(result.data(), result.data() + count, out + first);
+		}
+	}
+}
+
+//! Gradients of the trilinear interpolation of a batch of points, tile by tile.
+template<typename T>
+void VolumeT<T>::sampleGradientBatch(const double* xs, const double* ys, const double* zs, double* gxs, double* gys, double* gzs, size_t n) const
+{
+	const double* ps[3] = { xs, ys, zs };
+	double* gs[3] = { gxs, gys, gzs };
+	SampleTile t[3], c[8], g[3];
+	for (size_t first = 0; first < n; first += kVolumeSampleTile)
+	{
+		const size_t count = std::min<size_t>(kVolumeSampleTile, n - first);
+		loadSampleTile(ps, first, count, t, c);
+
+		interpolateGradient(t, c, g);
+		for (int a = 0; a < 3; a++)
+		{
+			if (count == kVolumeSampleTile)
+			{
+				Eigen::Map<SampleTile>(gs[a] + first) = g[a] * m_invSpacing[a];
+			}
+			else
+			{
+				g[a] *= m_invSpacing[a];
+				std::copy(g[a].data(), g[a].data() + count, gs[a] + first);
+			}
+		}
+	}
+}
+
+//! Vectorized locateCell() of the points [first, first + count) of a batch and their corner values (gatherCell()).
+template<typename T>
+void VolumeT<T>::loadSampleTile(const double* ps[3], size_t first, size_t count, SampleTile t[3], SampleTile c[8]) const
+{
+	// a partial tile is padded with its last point; the node indices stay doubles, Eigen has no vectorized conversion to integers
+	const uint dims[3] = { dx, dy, dz };
+	SampleTile i[3];
+	for (int a = 0; a < 3; a++)
+	{
+		SampleTile p;
+		if (count == kVolumeSampleTile)
+			p = Eigen::Map<const SampleTile>(ps[a] + first);
+		else
+			for (uint k = 0; k < kVolumeSampleTile; k++)
+				p[k] = ps[a][first + std::min<size_t>(k, count - 1)];
+
+		const SampleTile u = ((p - min[a]) * m_invSpacing[a]).max(0.0).min(double(dims[a] - 1));
+		i[a] = u.floor().min(double(std::max(dims[a], 2u) - 2));
+		t[a] = u - i[a];
+	}
+
+	if (m_layout == VolumeLayout::Linear)
+	{
+		// offsets of the corners as in gatherCell()
+		const size_t sx = dx > 1 ? (size_t)dy * dz : 0, sy = dy > 1 ? dz : 0, sz = dz > 1 ? 1 : 0;
+		const size_t offsets[8] = { 0, sx, sy, sx + sy, sz, sx + sz, sy + sz, sx + sy + sz };
+		const SampleTile base = (i[0] * dy + i[1]) * dz + i[2];
+		for (uint k = 0; k < kVolumeSampleTile; k++)
+		{
+			const T* p = vol + (size_t)base[k];
+			for (int n = 0; n < 8; n++)
+				c[n][k] = decode(p[offsets[n]]);
+		}
+		return;
+	}
+
+	double corners[8];
+	for (uint k = 0; k < kVolumeSampleTile; k++)
+	{
+		gatherCell((uint)i[0][k], (uint)i[1][k], (uint)i[2][k], corners);
+		for (int n = 0; n < 8; n++)
+			c[n][k] = corners[n];
+	}
+}
+
+//! Builds the coarser levels of the mip pyramid.
+template<typename T>
+void VolumeT<T>::buildPyramid(uint maxLevels)
+{
+	m_levels.clear();
+	updateBrickRanges();
+
+	for (VolumeT<T>* fine = this; m_levels.size() < maxLevels && std::min(fine->dx, std::min(fine->dy, fine->dz)) > 2; fine = m_levels.back().get())
+	{
+		// the box of the coarse level ends at its last node, which is the last node of the fine level unless its count is even
+		const uint cx = (fine->dx + 1) / 2, cy = (fine->dy + 1) / 2, cz = (fine->dz + 1) / 2;
+		const Vector3d coarseMax = fine->pos(2 * (cx - 1), 2 * (cy - 1), 2 * (cz - 1));
+		VolumeT<T>* coarse = new VolumeT<T>(fine->min, coarseMax, cx, cy, cz, m_dim, m_layout);
+		coarse->setQuantization(m_scale, m_offset);
+		m_levels.emplace_back(coarse);
+
+		// both levels store T with the same quantization, the values are copied without decoding them
+		ParallelFor(0, cx, [&](size_t x) {
+			for (uint y = 0; y < cy; y++)
+				for (uint z = 0; z < cz; z++)
+					coarse->vol[coarse->getPosFromTuple((int)x, y, z)] = fine->vol[fine->getPosFromTuple(2 * (int)x, 2 * y, 2 * z)];
+		});
+
+		// a coarse brick covers the fine bricks 2b and 2b + 1 along every axis
+		const size_t numBricks = (size_t)coarse->m_numBricks[0] * coarse->m_numBricks[1] * coarse->m_numBricks[2];
+		coarse->m_brickMin.assign(numBricks, std::numeric_limits<double>::max());
+		coarse->m_brickMax.assign(numBricks, std::numeric_limits<double>::lowest());
+		for (uint bx = 0; bx < fine->m_numBricks[0]; bx++)
+			for (uint by = 0; by < fine->m_numBricks[1]; by++)
+				for (uint bz = 0; bz < fine->m_numBricks[2]; bz++)
+				{
+					const size_t b = coarse->getBrickIndex(std::min(bx / 2, coarse->m_numBricks[0] - 1),
+						std::min(by / 2, coarse->m_numBricks[1] - 1), std::min(bz / 2, coarse->m_numBricks[2] - 1));
+					const size_t f = fine->getBrickIndex(bx, by, bz);
+					coarse->m_brickMin[b] = std::min(coarse->m_brickMin[b], fine->m_brickMin[f]);
+					coarse->m_brickMax[b] = std::max(coarse->m_brickMax[b], fine->m_brickMax[f]);
+				}
+		coarse->m_brickRangesValid = true;
+
+		coarse->minValue = *std::min_element(coarse->m_brickMin.begin(), coarse->m_brickMin.end());
+		coarse->maxValue = *std::max_element(coarse->m_brickMax.begin(), coarse->m_brickMax.end());
+	}
+}
+
+//! Passes a hint for the pages of the slab [x0, x1) to the mapped file.
+template<typename T>
+void VolumeT<T>::adviseSlab(uint x0, uint x1, bool evict) const
+{
+	x1 = std::min(x1, dx);
+	if (!m_file.IsOpen() || x0 >= x1) return;
+
+	// byte ranges of the values in the file
+	std::vector<std::pair<size_t, size_t>> ranges;
+	if (m_layout == VolumeLayout::Linear)
+	{
+		const size_t sliceSize = (size_t)dy * dz * sizeof(T);
+		ranges.push_back(std::make_pair(x0 * sliceSize, (x1 - x0) * sliceSize));
+	}
+	else
+	{
+		// the bricks of the slab are spread over the file, adjacent ones are merged
+		const size_t brickSize = kVolumeBrickSize * kVolumeBrickSize * kVolumeBrickSize * sizeof(T);
+		std::vector<size_t> offsets;
+		for (uint bx = x0 >> kVolumeBrickShift; bx <= (x1 - 1) >> kVolumeBrickShift; bx++)
+			for (uint by = 0; by < m_numBricks[1]; by++)
+				for (uint bz = 0; bz < m_numBricks[2]; bz++)
+					offsets.push_back(m_brickOffsets[getBrickIndex(bx, by, bz)] * sizeof(T));
+		std::sort(offsets.begin(), offsets.end());
+		for (size_t offset : offsets)
+		{
+			if (!ranges.empty() && ranges.back().first + ranges.back().second == offset)
+				ranges.back().second += brickSize;
+			else
+				ranges.push_back(std::make_pair(offset, brickSize));
+		}
+	}
+
+	for (const auto& range : ranges)
+	{
+		if (evict)
+			m_file.Evict(m_fileOffset + range.first, range.second);
+		else
+			m_file.Prefetch(m_fileOffset + range.first, range.second);
+	}
+}
+
 //! Sets all entries in the volume to '0'
-void Volume::clean()
+template<typename T>
+void VolumeT<T>::clean()
 {
-	for (uint i1 = 0; i1 < dx*dy*dz; i1++) vol[i1] = double(0.0);
+	for (size_t i1 = 0; i1 < m_dataSize; i1++) vol[i1] = encode(0.0);
+	m_brickRangesValid = false;
 }
 
 //! Sets minimum extension
-void Volume::SetMin(Vector3d min_)
+template<typename T>
+void VolumeT<T>::SetMin(Vector3d min_)
 {
 	min = min_;
-	diag = max - min;
+	compute_ddx_dddx();
 }
 
 //! Sets maximum extension
-void Volume::SetMax(Vector3d max_)
+template<typename T>
+void VolumeT<T>::SetMax(Vector3d max_)
 {
 	max = max_;
-	diag = max - min;
+	compute_ddx_dddx();
 }
+
+template class VolumeT<double>;
+template class VolumeT<float>;
+template class VolumeT<Half>;
+template class VolumeT<int16_t>;
@@ -4,28 +4,197 @@
 #define VOLUME_H
 
 #include <limits>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <type_traits>
+#include <algorithm>
+#include <memory>
 #include "Eigen.h"
+#include "MappedFile.h"
 typedef unsigned int uint;
 
-//! A regular volume dataset
-class Volume
+//! IEEE 754 half precision float (1 sign, 5 exponent and 10 mantissa bits), only used as storage.
+struct Half
+{
+	uint16_t bits;
+};
+
+inline float HalfToFloat(Half h)
+{
+	const uint32_t sign = (uint32_t)(h.bits & 0x8000) << 16;
+	const uint32_t exponent = (h.bits >> 10) & 0x1f;
+	uint32_t mantissa = h.bits & 0x3ff;
+
+	uint32_t bits;
+	if (exponent == 0x1f)
+	{
+		// inf and nan
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	}
+	else if (exponent != 0)
+	{
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	}
+	else if (mantissa != 0)
+	{
+		// subnormal: normalize the mantissa
+		int e = 113;
+		while (!(mantissa & 0x400))
+		{
+			mantissa <<= 1;
+			e--;
+		}
+		bits = sign | ((uint32_t)e << 23) | ((mantissa & 0x3ff) << 13);
+	}
+	else
+	{
+		bits = sign;
+	}
+
+	float f;
+	memcpy(&f, &bits, sizeof(float));
+	return f;
+}
+
+//! Rounds to the nearest half (ties to even). Values beyond the range of half become inf.
+inline Half FloatToHalf(float f)
+{
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(float));
+	const uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+	const uint32_t exponent = (bits >> 23) & 0xff;
+	const uint32_t mantissa = bits & 0x7fffff;
+
+	if (exponent == 0xff)
+		return { (uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0)) };
+
+	// exponent of the half, subnormals and zero if it is <= 0
+	const int e = (int)exponent - 112;
+	if (e >= 0x1f)
+		return { (uint16_t)(sign | 0x7c00) };
+
+	uint32_t m = mantissa | 0x800000;
+	int shift = 13;
+	if (e <= 0)
+	{
+		shift = 14 - e;
+		if (shift > 24) return { sign };
+	}
+
+	uint32_t result = m >> shift;
+	const uint32_t remainder = m & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+	if (remainder > halfway || (remainder == halfway && (result & 1)))
+		result++;
+
+	// the mantissa of a normal half loses its implicit bit, a carry into the exponent is the correct result
+	if (e > 0)
+		result = ((uint32_t)e << 10) + (result - 0x400);
+	return { (uint16_t)(sign | result) };
+}
+
+//! Conversion between the scalar type T of the storage of VolumeT and double.
+//! double and float are stored as they are, Half as IEEE half, and int16_t is quantized: value = offset + scale * q.
+template<typename T>
+struct VolumeStorage
+{
+	static inline double Decode(T v, double, double) { return (double)v; }
+	static inline T Encode(double v, double, double) { return (T)v; }
+};
+
+template<>
+struct VolumeStorage<Half>
+{
+	static inline double Decode(Half v, double, double) { return (double)HalfToFloat(v); }
+
+	//! Values too small for a half keep their sign (smallest subnormal instead of zero), so that the inside/outside
+	//! classification of marching cubes does not change.
+	static inline Half Encode(double v, double, double)
+	{
+		Half h = FloatToHalf((float)v);
+		if ((h.bits & 0x7fff) == 0 && v != 0.0) h.bits |= 1;
+		return h;
+	}
+};
+
+template<>
+struct VolumeStorage<int16_t>
+{
+	static inline double Decode(int16_t v, double scale, double offset) { return offset + scale * v; }
+
+	//! Rounds to the nearest step and clamps to the range of int16. Values that round to the offset keep their side of it,
+	//! so with the offset at the iso value, the inside/outside classification of marching cubes is exact.
+	static inline int16_t Encode(double v, double scale, double offset)
+	{
+		const double q = std::round((v - offset) / scale);
+		if (q == 0.0 && v != offset) return v < offset ? -1 : 1;
+		return (int16_t)std::max(-32767.0, std::min(32767.0, q));
+	}
+};
+
+//! Memory layout of the values of VolumeT.
+enum class VolumeLayout
+{
+	Linear,	//!< x*dy*dz + y*dz + z: every yz-slice is contiguous
+	Bricked	//!< bricks of 8^3 values in Morton order (and the values of a brick as well): the 2x2x2 values of a cell are in one
+			//!< cache line, unless the cell crosses a brick boundary. The bricks at the border are padded.
+};
+
+//! Edge length of the bricks of VolumeLayout::Bricked and of the min/max ranges of VolumeT (both layouts).
+const uint kVolumeBrickShift = 3;
+const uint kVolumeBrickSize = 1 << kVolumeBrickShift;
+
+//! Number of points that VolumeT::sampleBatch() and sampleGradientBatch() interpolate at once with SIMD (Eigen packets).
+const uint kVolumeSampleTile = 8;
+
+//! Spreads the lowest 10 bits of v to every third bit (bits 0, 3, 6, ...).
+inline uint MortonSpread3(uint v)
+{
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+//! MortonSpread3() of the coordinates inside a brick (0..7).
+const uint kVolumeBrickMorton[kVolumeBrickSize] = { 0, 1, 8, 9, 64, 65, 72, 73 };
+
+//! A regular volume dataset, with values of type T in memory (double, float, Half or quantized int16_t).
+//! All accessors take and return doubles; the conversion is done by VolumeStorage<T>.
+//! The volume also keeps the range of the values of every brick of 8^3 cells, so that extractors can skip the bricks that do not
+//! contain the iso-surface (see updateBrickRanges()).
+//! The values can live in a memory-mapped file instead of main memory, for grids that do not fit into it; sequential passes
+//! over such a volume should go slab by slab and pass the hints prefetchSlab() and evictSlab().
+template<typename T>
+class VolumeT
 {
 public:
+	typedef T StorageType;
 
-	//! Initializes an empty volume dataset.
-	Volume(Vector3d min_, Vector3d max_, uint dx_ = 10, uint dy_ = 10, uint dz_ = 10, uint dim = 1);
+	//! Initializes an empty volume dataset. If mappedFile is given, the values are stored in that file from byte fileOffset on
+	//! (e.g. behind the header of a blob: BlobCache::GetPath() and BlobCache::GetHeaderSize(), the header is written with
+	//! BlobCache::Commit() once the values are complete); values that are already in the file are kept. Check isMapped(),
+	//! the mapping fails e.g. if the file cannot be created.
+	VolumeT(Vector3d min_, Vector3d max_, uint dx_ = 10, uint dy_ = 10, uint dz_ = 10, uint dim = 1, VolumeLayout layout = VolumeLayout::Linear,
+		const std::string& mappedFile = std::string(), size_t fileOffset = 0);
 
-	~Volume();
+	~VolumeT();
 
 	inline void computeMinMaxValues(double& minVal, double& maxVal) const
 	{
 		minVal = std::numeric_limits<double>::max();
 		maxVal = -minVal;
-		for (uint i1 = 0; i1 < dx*dy*dz; i1++)
-		{
-			if (minVal > vol[i1]) minVal = vol[i1];
-			if (maxVal < vol[i1]) maxVal = vol[i1];
-		}
+		for (uint x = 0; x < dx; x++)
+			for (uint y = 0; y < dy; y++)
+				for (uint z = 0; z < dz; z++)
+				{
+					const double val = get(x, y, z);
+					if (minVal > val) minVal = val;
+					if (maxVal < val) maxVal = val;
+				}
 	}
 
 	//! Computes spacing in x,y,z-directions.
@@ -35,7 +204,7 @@ public:
 	void zeroOutMemory();
 
 	//! Set the value at i.
-	inline void set(uint i, double val)
+	inline void set(size_t i, double val)
 	{
 		if (val > maxValue)
 			maxValue = val;
@@ -43,25 +212,27 @@ public:
 		if (val < minValue)
 			minValue = val;
 
-		vol[i] = val;
+		vol[i] = encode(val);
+		m_brickRangesValid = false;
 	}
 
 	//! Set the value at (x_, y_, z_).
 	inline void set(uint x_, uint y_, uint z_, double val)
 	{
-		vol[getPosFromTuple(x_, y_, z_)] = val;
+		vol[getPosFromTuple(x_, y_, z_)] = encode(val);
+		m_brickRangesValid = false;
 	};
 
 	//! Get the value at (x_, y_, z_).
-	inline double get(uint i) const
+	inline double get(size_t i) const
 	{
-		return vol[i];
+		return decode(vol[i]);
 	};
 
 	//! Get the value at (x_, y_, z_).
 	inline double get(uint x_, uint y_, uint z_) const
 	{
-		return vol[getPosFromTuple(x_, y_, z_)];
+		return decode(vol[getPosFromTuple(x_, y_, z_)]);
 	};
 
 	//! Get the value at (pos.x, pos.y, pos.z).
@@ -70,6 +241,125 @@ public:
 		return(get(pos_[0], pos_[1], pos_[2]));
 	}
 
+	//! Trilinear interpolation of the node values at the point p. Points outside the volume are clamped to its boundary.
+	inline double sample(const Vector3d& p) const
+	{
+		uint i[3];
+		double t[3], c[8];
+		for (int a = 0; a < 3; a++)
+			locateCell(p[a], a, i[a], t[a]);
+		gatherCell(i[0], i[1], i[2], c);
+		return interpolate(t, c);
+	}
+
+	//! Gradient of the trilinear interpolation at the point p (per unit length). Points outside the volume are clamped to its
+	//! boundary, i.e. they get the gradient of the closest cell.
+	inline Vector3d sampleGradient(const Vector3d& p) const
+	{
+		uint i[3];
+		double t[3], c[8];
+		for (int a = 0; a < 3; a++)
+			locateCell(p[a], a, i[a], t[a]);
+		gatherCell(i[0], i[1], i[2], c);
+
+		double g[3];
+		interpolateGradient(t, c, g);
+		return Vector3d(g[0] * m_invSpacing[0], g[1] * m_invSpacing[1], g[2] * m_invSpacing[2]);
+	}
+
+	//! sample() of n points in SoA layout, like ImplicitSurface::EvalBatch(). The points are processed in tiles of
+	//! kVolumeSampleTile: the cell lookup and the interpolation are vectorized, only the corner values are gathered one by one.
+	void sampleBatch(const double* xs, const double* ys, const double* zs, double* out, size_t n) const;
+
+	//! sampleGradient() of n points in SoA layout, see sampleBatch().
+	void sampleGradientBatch(const double* xs, const double* ys, const double* zs, double* gxs, double* gys, double* gzs, size_t n) const;
+
+	//! The queries above on a level of the mip pyramid (see buildPyramid()).
+	inline double sample(const Vector3d& p, uint level) const { return getLevel(level)->sample(p); }
+	inline Vector3d sampleGradient(const Vector3d& p, uint level) const { return getLevel(level)->sampleGradient(p); }
+	void sampleBatch(const double* xs, const double* ys, const double* zs, double* out, size_t n, uint level) const
+	{
+		getLevel(level)->sampleBatch(xs, ys, zs, out, n);
+	}
+	void sampleGradientBatch(const double* xs, const double* ys, const double* zs, double* gxs, double* gys, double* gzs, size_t n, uint level) const
+	{
+		getLevel(level)->sampleGradientBatch(xs, ys, zs, gxs, gys, gzs, n);
+	}
+
+	//! Builds up to maxLevels coarser levels of a mip pyramid, in memory. Level l + 1 has the nodes of level l with even
+	//! indices, (d + 1) / 2 per axis, so it holds the values of a sampling at half the resolution (for an even number of
+	//! nodes, the last layer of cells is dropped). The levels are built until an axis has 2 nodes, in parallel over the slices.
+	//! The brick ranges of a level are the union of those of the level below, so they bound all values of the full resolution
+	//! volume in their region (isBrickEmpty() of a coarse level is conservative), and so are minValue and maxValue of a
+	//! level. The levels are not updated when values are set, build the pyramid again.
+	void buildPyramid(uint maxLevels = std::numeric_limits<uint>::max());
+
+	//! Number of levels, including this volume (level 0).
+	inline uint getNumLevels() const { return 1 + (uint)m_levels.size(); }
+
+	//! A level of the mip pyramid, to be passed to the extractors and queries; levels beyond the coarsest give the coarsest.
+	inline VolumeT<T>* getLevel(uint level)
+	{
+		level = std::min(level, getNumLevels() - 1);
+		return level ? m_levels[level - 1].get() : this;
+	}
+	inline const VolumeT<T>* getLevel(uint level) const
+	{
+		level = std::min(level, getNumLevels() - 1);
+		return level ? m_levels[level - 1].get() : this;
+	}
+
+	//! Returns the values of the yz-slice x (dy*dz values, z is contiguous). For double storage in the linear layout, this is a
+	//! pointer into the volume, otherwise the values are decoded into buffer.
+	inline const double* getSlice(uint x, std::vector<double>& buffer) const
+	{
+		const size_t sliceSize = (size_t)dy * dz;
+		if (m_layout == VolumeLayout::Linear)
+		{
+			const T* slice = vol + x * sliceSize;
+			if (std::is_same<T, double>::value)
+				return reinterpret_cast<const double*>(slice);
+
+			buffer.resize(sliceSize);
+			for (size_t i = 0; i < sliceSize; i++)
+				buffer[i] = decode(slice[i]);
+			return buffer.data();
+		}
+
+		// a row of a brick: the Morton codes of its values only differ in the bits of z
+		buffer.resize(sliceSize);
+		const uint mask = kVolumeBrickSize - 1;
+		for (uint y = 0; y < dy; y++)
+		{
+			const size_t* offsets = &m_brickOffsets[getBrickIndex(x >> kVolumeBrickShift, y >> kVolumeBrickShift, 0)];
+			const uint local = (kVolumeBrickMorton[x & mask] << 2) | (kVolumeBrickMorton[y & mask] << 1);
+			double* out = &buffer[(size_t)y * dz];
+			for (uint bz = 0; bz < m_numBricks[2]; bz++, out += kVolumeBrickSize)
+			{
+				const T* row = vol + offsets[bz] + local;
+				const uint n = std::min(kVolumeBrickSize, dz - (bz << kVolumeBrickShift));
+				for (uint z = 0; z < n; z++)
+					out[z] = decode(row[kVolumeBrickMorton[z]]);
+			}
+		}
+		return buffer.data();
+	}
+
+	//! Recomputes the range of the values of the cells of every brick (the nodes of the brick and the first ones of the next bricks)
+	//! if values were set since the last call. Must not be called concurrently.
+	void updateBrickRanges();
+
+	//! True if all nodes of the cells of the brick (bx, by, bz) are on the same side of the iso value (inside: value < iso, as
+	//! in marching cubes), i.e. the brick does not contain the iso-surface. The brick ranges must be up to date.
+	inline bool isBrickEmpty(uint bx, uint by, uint bz, double iso) const
+	{
+		const size_t b = getBrickIndex(bx, by, bz);
+		return m_brickMin[b] >= iso || m_brickMax[b] < iso;
+	}
+
+	//! Number of bricks in x, y and z-direction.
+	inline uint getNumBricks(int axis) const { return m_numBricks[axis]; }
+
 	//! Returns the cartesian x-coordinates of node (i,..).
 	inline double posX(int i) const
 	{
@@ -100,8 +390,36 @@ public:
 		return coord;
 	}
 
-	//! Returns the Data.
-	double* getData();
+	//! Returns the Data (invalidates the brick ranges, since it may be written).
+	T* getData();
+
+	//! Number of values in getData(): dx*dy*dz, plus the padding of the bricks.
+	inline size_t getDataSize() const { return m_dataSize; }
+
+	inline VolumeLayout getLayout() const { return m_layout; }
+
+	//! True if the values are stored in a memory-mapped file (and the mapping succeeded).
+	inline bool isMapped() const { return m_file.IsOpen(); }
+
+	//! Hints for mapped volumes that the nodes of the yz-slices [x0, x1) are read soon, or not needed for a while
+	//! (no-ops in memory). Evicting is always safe: modified values are written to the file and read again on access.
+	void prefetchSlab(uint x0, uint x1) const { adviseSlab(x0, x1, false); }
+	void evictSlab(uint x0, uint x1) const { adviseSlab(x0, x1, true); }
+
+	//! Hints for a pass over the slices in increasing order from x = begin, call it for every slice x before reading it: on slab
+	//! boundaries it prefetches the next slab of kVolumeBrickSize slices and evicts the one behind x (except x - 1, which the
+	//! extractors still read with x).
+	void adviseSequential(uint x, uint begin) const
+	{
+		if (!m_file.IsOpen() || ((x - begin) & (kVolumeBrickSize - 1))) return;
+
+		if (x == begin) prefetchSlab(x, x + kVolumeBrickSize);
+		prefetchSlab(x + kVolumeBrickSize, x + 2 * kVolumeBrickSize);
+		if (x > begin) evictSlab(x - kVolumeBrickSize, x - 1);
+	}
+
+	//! Writes the values of a mapped volume to its file, returns false on an error (or in memory).
+	bool flush() const { return m_file.Flush(); }
 
 	//! Sets all entries in the volume to '0'
 	void clean();
@@ -124,9 +442,26 @@ public:
 	//! Sets maximum extension
 	void SetMax(Vector3d max_);
 
-	inline uint getPosFromTuple(int x, int y, int z) const
+	//! Sets the quantization of int16_t storage (value = offset + scale * q, |q| <= 32767), before any value is set.
+	//! Put the offset at the iso value and choose the scale for the precision that is needed near it; values farther away
+	//! than 32767 * scale are clamped, which does not matter for the extraction. Ignored by the other storage types.
+	void setQuantization(double scale, double offset)
+	{
+		m_scale = scale;
+		m_offset = offset;
+	}
+
+	inline double getScale() const { return m_scale; }
+	inline double getOffset() const { return m_offset; }
+
+	inline size_t getPosFromTuple(int x, int y, int z) const
 	{
-		return x*dy*dz + y*dz + z;
+		if (m_layout == VolumeLayout::Linear)
+			return ((size_t)x*dy + y)*dz + z;
+
+		const uint mask = kVolumeBrickSize - 1;
+		const size_t brick = m_brickOffsets[getBrickIndex(x >> kVolumeBrickShift, y >> kVolumeBrickShift, z >> kVolumeBrickShift)];
+		return brick + ((kVolumeBrickMorton[x & mask] << 2) | (kVolumeBrickMorton[y & mask] << 1) | kVolumeBrickMorton[z & mask]);
 	}
 
 
@@ -142,7 +477,7 @@ public:
 	//! Number of cells in x, y and z-direction.
 	uint dx, dy, dz;
 
-	double* vol;
+	T* vol;
 
 	double maxValue, minValue;
 
@@ -150,11 +485,115 @@ public:
 
 private:
 
+	inline double decode(T val) const
+	{
+		return VolumeStorage<T>::Decode(val, m_scale, m_offset);
+	}
+
+	inline T encode(double val) const
+	{
+		return VolumeStorage<T>::Encode(val, m_scale, m_offset);
+	}
+
+	inline size_t getBrickIndex(uint bx, uint by, uint bz) const
+	{
+		return ((size_t)bx * m_numBricks[1] + by) * m_numBricks[2] + bz;
+	}
+
+	void adviseSlab(uint x0, uint x1, bool evict) const;
+
+	//! Cell (lower node index i) and local coordinate t in [0, 1] of the coordinate p along axis a, clamped to the volume.
+	inline void locateCell(double p, int a, uint& i, double& t) const
+	{
+		const uint d = a == 0 ? dx : (a == 1 ? dy : dz);
+		const double u = std::min(std::max((p - min[a]) * m_invSpacing[a], 0.0), double(d - 1));
+		i = d > 1 ? std::min((uint)u, d - 2) : 0;
+		t = u - i;
+	}
+
+	//! Trilinear interpolation and its gradient (per cell) of the corner values c at the local coordinates t, for single points
+	//! (double) and tiles of points (SampleTile).
+	template<typename A>
+	static inline A interpolate(const A t[3], const A c[8])
+	{
+		const A c00 = c[0] + t[0] * (c[1] - c[0]), c10 = c[2] + t[0] * (c[3] - c[2]);
+		const A c01 = c[4] + t[0] * (c[5] - c[4]), c11 = c[6] + t[0] * (c[7] - c[6]);
+		const A c0 = c00 + t[1] * (c10 - c00), c1 = c01 + t[1] * (c11 - c01);
+		return c0 + t[2] * (c1 - c0);
+	}
+
+	template<typename A>
+	static inline void interpolateGradient(const A t[3], const A c[8], A g[3])
+	{
+		// bilinear interpolation of the differences along each axis over the other two
+		const A x0 = c[1] - c[0], x1 = c[3] - c[2], x2 = c[5] - c[4], x3 = c[7] - c[6];
+		const A y0 = c[2] - c[0], y1 = c[3] - c[1], y2 = c[6] - c[4], y3 = c[7] - c[5];
+		const A z0 = c[4] - c[0], z1 = c[5] - c[1], z2 = c[6] - c[2], z3 = c[7] - c[3];
+		const A gx0 = x0 + t[1] * (x1 - x0), gx1 = x2 + t[1] * (x3 - x2);
+		const A gy0 = y0 + t[0] * (y1 - y0), gy1 = y2 + t[0] * (y3 - y2);
+		const A gz0 = z0 + t[0] * (z1 - z0), gz1 = z2 + t[0] * (z3 - z2);
+		g[0] = gx0 + t[2] * (gx1 - gx0);
+		g[1] = gy0 + t[2] * (gy1 - gy0);
+		g[2] = gz0 + t[1] * (gz1 - gz0);
+	}
+
+	typedef Eigen::Array<double, kVolumeSampleTile, 1> SampleTile;
+
+	void loadSampleTile(const double* ps[3], size_t first, size_t count, SampleTile t[3], SampleTile c[8]) const;
+
+	//! The values of the 8 nodes of the cell (x, y, z); corner c is at (x + (c & 1), y + ((c >> 1) & 1), z + (c >> 2)).
+	//! Along an axis with a single node, both corners are that node.
+	inline void gatherCell(uint x, uint y, uint z, double c[8]) const
+	{
+		const uint x1 = dx > 1 ? x + 1 : x, y1 = dy > 1 ? y + 1 : y, z1 = dz > 1 ? z + 1 : z;
+		if (m_layout == VolumeLayout::Linear)
+		{
+			const T* p = vol + getPosFromTuple(x, y, z);
+			const size_t sx = (size_t)(x1 - x) * dy * dz, sy = (size_t)(y1 - y) * dz, sz = z1 - z;
+			c[0] = decode(p[0]); c[1] = decode(p[sx]); c[2] = decode(p[sy]); c[3] = decode(p[sx + sy]);
+			c[4] = decode(p[sz]); c[5] = decode(p[sx + sz]); c[6] = decode(p[sy + sz]); c[7] = decode(p[sx + sy + sz]);
+			return;
+		}
+
+		for (int k = 0; k < 8; k++)
+			c[k] = get((k & 1) ? x1 : x, ((k >> 1) & 1) ? y1 : y, (k >> 2) ? z1 : z);
+	}
+
 	//! x,y,z access to vol*
 	inline double vol_access(int x, int y, int z) const
 	{
-		return vol[getPosFromTuple(x, y, z)];
+		return get(getPosFromTuple(x, y, z));
 	}
+
+	//! Nodes per unit length along every axis (0 for an axis with a single node).
+	Vector3d m_invSpacing;
+
+	//! Quantization of int16_t storage.
+	double m_scale = 1.0 / 32767, m_offset = 0.0;
+
+	VolumeLayout m_layout;
+	size_t m_dataSize;
+
+	//! Number of bricks per axis, the offset of every brick in vol (bricked layout) and the value ranges of the bricks.
+	uint m_numBricks[3];
+	std::vector<size_t> m_brickOffsets;
+	std::vector<double> m_brickMin, m_brickMax;
+	bool m_brickRangesValid = false;
+
+	//! Levels 1, 2, ... of the mip pyramid.
+	std::vector<std::unique_ptr<VolumeT<T>>> m_levels;
+
+	//! Backing file of a mapped volume (vol points into it).
+	MappedFile m_file;
+	size_t m_fileOffset = 0;
 };
 
+// the members that are not inline are instantiated in Volume.cpp for these types
+extern template class VolumeT<double>;
+extern template class VolumeT<float>;
+extern template class VolumeT<Half>;
+extern template class VolumeT<int16_t>;
+
+typedef VolumeT<double> Volume;
+
 #endif // VOLUME_H
@@ -0,0 +1,232 @@
+#pragma once
+
+#ifndef VOLUME_SAMPLER_H
+#define VOLUME_SAMPLER_H
+
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <functional>
+
+#include "ImplicitSurface.h"
+#include "Volume.h"
+
+//! Fills the volume with the values of the implicit surface.
+//! The grid is traversed row by row (fixed x and y), and every row is evaluated with a single EvalBatch() call on SoA coordinates.
+//! A mapped volume is written slab by slab, the slabs that are done are evicted from memory.
+template<typename T>
+inline void SampleVolume(ImplicitSurface* surface, VolumeT<T>& vol)
+{
+	const uint dz = vol.getDimZ();
+	std::vector<double> xs(dz), ys(dz), zs(dz), vals(dz);
+
+	for (uint z = 0; z < dz; z++)
+		zs[z] = vol.posZ(z);
+
+	for (uint x = 0; x < vol.getDimX(); x++)
+	{
+		vol.adviseSequential(x, 0);
+		std::fill(xs.begin(), xs.end(), vol.posX(x));
+
+		for (uint y = 0; y < vol.getDimY(); y++)
+		{
+			std::fill(ys.begin(), ys.end(), vol.posY(y));
+
+			surface->EvalBatch(xs.data(), ys.data(), zs.data(), vals.data(), dz);
+
+			for (uint z = 0; z < dz; z++)
+				vol.set(x, y, z, vals[z]);
+		}
+	}
+}
+
+struct NarrowBandOptions
+{
+	//! Cell size of the coarsest grid in voxels (rounded up to a power of two).
+	uint coarseStep = 8;
+
+	//! Upper bound of |grad f| in the volume. If it is <= 0, a bound is estimated for every cell: the largest slope along the
+	//! edges of the cell and its parents, multiplied by safetyFactor. This assumes that the field is smooth at the scale of the
+	//! coarse grid; a single global bound would be far too pessimistic for the RBF, which grows like r^3 away from the points.
+	//! The estimate is a heuristic: a feature that is thinner than the coarse cells and does not change the sign at their corners
+	//! (e.g. a thin sheet or a small component) can be missed. Only a true bound guarantees the mesh of the full evaluation.
+	double lipschitz = 0.0;
+	double safetyFactor = 2.0;
+
+	//! Polled between batches of at most evalChunk evaluations; if it returns true, the sampling stops and leaves the volume
+	//! incomplete (e.g. when a time budget is exceeded).
+	std::function<bool()> cancel;
+	size_t evalChunk = 16384;
+};
+
+//! Fills the volume like SampleVolume(), but evaluates the surface at full resolution only in a narrow band around the iso-surface.
+//! The volume is covered with cells of coarseStep voxels, whose corners are evaluated. A cell can only contain the surface if its
+//! corners are on different sides of the iso value, or if a corner is closer to it than L times half the cell diagonal (Lipschitz
+//! bound with L >= |grad f| in the cell). These cells are split into 8 children whose corners are evaluated in turn, down to single
+//! voxels. The voxels of the other cells get the trilinear interpolation of the cell corners, which is on the same side of the iso
+//! value. Marching cubes only uses the values of voxels with a sign change, which are all evaluated, so the mesh is the same as
+//! after a full evaluation, while the number of evaluations scales with the area of the surface (O(n^2) for n^3 voxels).
+//! This holds if NarrowBandOptions::lipschitz is a true bound of |grad f|. The default estimates the bound per cell, then thin
+//! features between the corners of a coarse cell can be skipped (see NarrowBandOptions::lipschitz).
+//! Returns the number of evaluated positions.
+//! The samples of a coarser volume can be reused: node (x, y, z) of coarser is node (2x, 2y, 2z) of vol, which needs the same
+//! box and 2n - 1 nodes per axis for n nodes of coarser. evaluated holds the nodes of coarser that were evaluated (indexed like
+//! the linear layout, as returned by the call that sampled coarser), or all of them if it is null or empty. On return,
+//! evaluated holds the evaluated or reused nodes of vol.
+template<typename T>
+inline size_t SampleVolumeNarrowBand(ImplicitSurface* surface, VolumeT<T>& vol, double iso = 0.0, const NarrowBandOptions& options = NarrowBandOptions(),
+	const VolumeT<T>* coarser = nullptr, std::vector<bool>* evaluated = nullptr)
+{
+	const uint dims[3] = { vol.getDimX(), vol.getDimY(), vol.getDimZ() };
+	if (dims[0] < 2 || dims[1] < 2 || dims[2] < 2)
+	{
+		SampleVolume(surface, vol);
+		if (evaluated) evaluated->assign((size_t)dims[0] * dims[1] * dims[2], true);
+		return (size_t)dims[0] * dims[1] * dims[2];
+	}
+
+	struct Cell
+	{
+		uint origin[3];
+		double lipschitz;
+	};
+
+	uint step = 1;
+	while (step < options.coarseStep) step *= 2;
+
+	std::vector<Cell> cells, children;
+	for (uint x = 0; x < dims[0] - 1; x += step)
+		for (uint y = 0; y < dims[1] - 1; y += step)
+			for (uint z = 0; z < dims[2] - 1; z += step)
+				cells.push_back({ { x, y, z }, 0.0 });
+
+	// evaluated voxels, by their linear index (independent of the layout of the volume)
+	std::vector<bool> known((size_t)dims[0] * dims[1] * dims[2], false);
+	std::vector<size_t> indices;
+	std::vector<double> xs, ys, zs, vals;
+	size_t numEvals = 0;
+
+	if (coarser)
+	{
+		const uint coarseDims[3] = { coarser->getDimX(), coarser->getDimY(), coarser->getDimZ() };
+		const bool all = !evaluated || evaluated->empty();
+		for (uint x = 0; x < coarseDims[0] && 2 * x < dims[0]; x++)
+			for (uint y = 0; y < coarseDims[1] && 2 * y < dims[1]; y++)
+				for (uint z = 0; z < coarseDims[2] && 2 * z < dims[2]; z++)
+				{
+					if (!all && !(*evaluated)[((size_t)x * coarseDims[1] + y) * coarseDims[2] + z]) continue;
+
+					known[((size_t)2 * x * dims[1] + 2 * y) * dims[2] + 2 * z] = true;
+					vol.set(2 * x, 2 * y, 2 * z, coarser->get(x, y, z));
+				}
+	}
+
+	for (; !cells.empty(); step /= 2)
+	{
+		// evaluate all corners of the cells of this level that are not known yet in one batch
+		indices.clear();
+		xs.clear(); ys.clear(); zs.clear();
+		for (const Cell& cell : cells)
+			for (int c = 0; c < 8; c++)
+			{
+				const uint x = std::min(cell.origin[0] + (c & 1) * step, dims[0] - 1);
+				const uint y = std::min(cell.origin[1] + ((c >> 1) & 1) * step, dims[1] - 1);
+				const uint z = std::min(cell.origin[2] + (c >> 2) * step, dims[2] - 1);
+				const size_t i = ((size_t)x * dims[1] + y) * dims[2] + z;
+				if (known[i]) continue;
+
+				known[i] = true;
+				indices.push_back(i);
+				xs.push_back(vol.posX(x)); ys.push_back(vol.posY(y)); zs.push_back(vol.posZ(z));
+			}
+		vals.resize(indices.size());
+		for (size_t first = 0; first < indices.size(); first += options.evalChunk)
+		{
+			if (options.cancel && options.cancel()) return numEvals;
+
+			const size_t count = std::min(options.evalChunk, indices.size() - first);
+			surface->EvalBatch(&xs[first], &ys[first], &zs[first], &vals[first], count);
+			numEvals += count;
+		}
+		for (size_t n = 0; n < indices.size(); n++)
+			vol.set((uint)(indices[n] / dims[2] / dims[1]), (uint)(indices[n] / dims[2] % dims[1]), (uint)(indices[n] % dims[2]), vals[n]);
+
+		children.clear();
+		for (const Cell& cell : cells)
+		{
+			uint lo[3], hi[3];
+			for (int a = 0; a < 3; a++)
+			{
+				lo[a] = cell.origin[a];
+				hi[a] = std::min(cell.origin[a] + step, dims[a] - 1);
+			}
+			const Vector3d h = vol.pos(hi[0], hi[1], hi[2]) - vol.pos(lo[0], lo[1], lo[2]);
+
+			double f[8];
+			for (int c = 0; c < 8; c++)
+				f[c] = vol.get((c & 1) ? hi[0] : lo[0], ((c >> 1) & 1) ? hi[1] : lo[1], (c >> 2) ? hi[2] : lo[2]);
+
+			double lipschitz = options.lipschitz;
+			if (lipschitz <= 0.0)
+			{
+				// corners c and c ^ (1 << a) span the edges along axis a
+				lipschitz = cell.lipschitz;
+				for (int a = 0; a < 3; a++)
+					for (int c = 0; c < 8; c++)
+						if (!(c & (1 << a)))
+							lipschitz = std::max(lipschitz, options.safetyFactor * std::abs(f[c ^ (1 << a)] - f[c]) / h[a]);
+			}
+
+			bool below = false, above = false;
+			double minDist = std::numeric_limits<double>::max();
+			for (int c = 0; c < 8; c++)
+			{
+				(f[c] < iso ? below : above) = true;
+				minDist = std::min(minDist, std::abs(f[c] - iso));
+			}
+
+			if ((below && above) || minDist <= lipschitz * 0.5 * h.norm())
+			{
+				// the corners of a single voxel are all evaluated
+				if (step == 1) continue;
+
+				const uint half = step / 2;
+				for (int c = 0; c < 8; c++)
+				{
+					Cell child = { { lo[0] + (c & 1) * half, lo[1] + ((c >> 1) & 1) * half, lo[2] + (c >> 2) * half }, lipschitz };
+					if (child.origin[0] < hi[0] && child.origin[1] < hi[1] && child.origin[2] < hi[2])
+						children.push_back(child);
+				}
+				continue;
+			}
+
+			// the surface does not pass through the cell, interpolate the voxels that are not evaluated
+			for (uint x = lo[0]; x <= hi[0]; x++)
+			{
+				const double tx = double(x - lo[0]) / (hi[0] - lo[0]);
+				for (uint y = lo[1]; y <= hi[1]; y++)
+				{
+					const double ty = double(y - lo[1]) / (hi[1] - lo[1]);
+					const double f00 = (1 - tx) * f[0] + tx * f[1], f10 = (1 - tx) * f[2] + tx * f[3];
+					const double f01 = (1 - tx) * f[4] + tx * f[5], f11 = (1 - tx) * f[6] + tx * f[7];
+					const double f0 = (1 - ty) * f00 + ty * f10, f1 = (1 - ty) * f01 + ty * f11;
+					for (uint z = lo[2]; z <= hi[2]; z++)
+					{
+						const size_t i = ((size_t)x * dims[1] + y) * dims[2] + z;
+						if (known[i]) continue;
+
+						const double tz = double(z - lo[2]) / (hi[2] - lo[2]);
+						vol.set(x, y, z, (1 - tz) * f0 + tz * f1);
+					}
+				}
+			}
+		}
+		cells.swap(children);
+	}
+
+	if (evaluated) evaluated->swap(known);
+	return numEvals;
+}
+
+#endif // VOLUME_SAMPLER_H
@@ -1,51 +1,155 @@
 #include <iostream>
+#include <typeinfo>
 
 #include "Eigen.h"
 #include "ImplicitSurface.h"
+#include "CompactRBF.h"
+#include "IMLS.h"
+#include "PartitionOfUnity.h"
+#include "ScreenedPoisson.h"
 #include "Volume.h"
 #include "MarchingCubes.h"
+#include "AdaptiveMarchingCubes.h"
+#include "SurfaceNets.h"
+#include "VolumeSampler.h"
+#include "ProgressiveReconstruction.h"
+#include "SurfaceFactory.h"
+#include "Cache.h"
 
 int main()
 {
 	std::string filenameIn = "../../Data/normalized.pcb";
 	std::string filenameOut = "result.off";
 
-	// implicit surface
-	ImplicitSurface* surface;
+	// sampled volumes and RBF coefficients are cached in this directory, e.g. "." (empty: no cache). Nothing is evicted from it.
+	std::string cacheDirectory;
+
+	// implicit surface, given by its type and constructor arguments: it is constructed where it is evaluated, a cached volume
+	// of the same arguments is loaded without constructing it
 	// TODO: you have to switch between these surface types
-	//surface = new Sphere(Eigen::Vector3d(0.5, 0.5, 0.5), 0.4);
-	//surface = new Torus(Eigen::Vector3d(0.5, 0.5, 0.5), 0.4, 0.1);
-	//surface = new Hoppe(filenameIn);
-	surface = new RBF(filenameIn);
+	RBFOptions rbfOptions;
+	rbfOptions.cacheDirectory = cacheDirectory;
+	//SurfaceFactory surfaceFactory = MakeSurfaceFactory<Sphere>(Eigen::Vector3d(0.5, 0.5, 0.5), 0.4);
+	//SurfaceFactory surfaceFactory = MakeSurfaceFactory<Torus>(Eigen::Vector3d(0.5, 0.5, 0.5), 0.4, 0.1);
+	//SurfaceFactory surfaceFactory = MakeSurfaceFactory<Hoppe>(filenameIn);
+	//SurfaceFactory surfaceFactory = MakeSurfaceFactory<CompactRBF>(filenameIn, 0.05); // support radius ~ 3-5x the point spacing
+	//SurfaceFactory surfaceFactory = MakeSurfaceFactory<IMLS>(filenameIn, 0.02); // bandwidth ~ 1-2x the point spacing
+	//SurfaceFactory surfaceFactory = MakeSurfaceFactory<PartitionOfUnityRBF>(filenameIn, 64, 1.25, rbfOptions); // local RBFs for large point clouds
+	//SurfaceFactory surfaceFactory = MakeSurfaceFactory<ScreenedPoisson>(filenameIn); // millions of points, see poisson_benchmark for the crossover to the RBF
+	SurfaceFactory surfaceFactory = MakeSurfaceFactory<RBF>(filenameIn, rbfOptions);
+	//SurfaceFactory surfaceFactory = MakeSurfaceFactory<RBF>(filenameIn, rbfOptions, 1e-4); // treecode evaluation for large point clouds
 
 	// fill volume with signed distance values
 	unsigned int mc_res = 50; // resolution of the grid, for debugging you can reduce the resolution (-> faster)
-	Volume vol(Vector3d(-0.1,-0.1,-0.1), Vector3d(1.1,1.1,1.1), mc_res, mc_res, mc_res, 1);
-	for (unsigned int x = 0; x < vol.getDimX(); x++)
+	const Vector3d volMin(-0.1, -0.1, -0.1), volMax(1.1, 1.1, 1.1);
+	bool narrowBand = true; // evaluate the surface only near the iso-surface; with the estimated Lipschitz bound, features thinner than 8 voxels may be missed
+	typedef VolumeT<double> SampledVolume; // VolumeT<float>, VolumeT<Half> or VolumeT<int16_t> need 2 or 4 times less memory
+	VolumeLayout volumeLayout = VolumeLayout::Linear; // Bricked: 8^3 bricks in Morton order, for random access on large grids
+	bool outOfCore = false; // map the volume to its blob in the cache directory (required), for grids that do not fit into memory (1024^3 and up)
+	SimpleMesh mesh;
+
+	// adaptive extraction on an octree that is refined by the surface itself, without the dense volume (and its cache)
+	bool adaptiveExtraction = false;
+
+	// progressive extraction at 16^3, 32^3, ... cells until the time budget (in seconds) runs out; every finished level is written
+	bool progressive = false;
+	double timeBudget = 1.0;
+	if (progressive)
+	{
+		ImplicitSurface* surface = surfaceFactory.create();
+		ProgressiveOptions progressiveOptions;
+		progressiveOptions.timeBudget = timeBudget;
+		const uint resolution = ReconstructProgressive<double>(surface, volMin, volMax, &mesh, [&](SimpleMesh& levelMesh, uint n, double seconds) {
+			std::cerr << "Progressive: " << n - 1 << "^3 cells after " << seconds << " s" << std::endl;
+			levelMesh.WriteMesh(filenameOut);
+		}, progressiveOptions);
+		if (resolution == 0)
+			std::cerr << "Progressive: no level finished within " << timeBudget << " s" << std::endl;
+		delete surface;
+	}
+	else if (adaptiveExtraction)
+	{
+		ImplicitSurface* surface = surfaceFactory.create();
+		AdaptiveMarchingCubes amc;
+		amc.Extract(surface, volMin, volMax, 0.00f, &mesh);
+		std::cerr << "Adaptive Marching Cubes: " << amc.GetNumEvals() << " evaluations, " << amc.GetNumLeaves() << " leaves" << std::endl;
+		delete surface;
+	}
+	else
 	{
-		for (unsigned int y = 0; y < vol.getDimY(); y++)
+		const double quantizationScale = 1e-4, quantizationOffset = 0.00f; // int16_t: steps of 1e-4 around the iso value, i.e. +-3.3 before it is clamped
+
+		if (outOfCore && cacheDirectory.empty())
 		{
-			for (unsigned int z = 0; z < vol.getDimZ(); z++)
-			{
-				Eigen::Vector3d p = vol.pos(x, y, z);
-				double val = surface->Eval(p);
-				vol.set(x,y,z, val);
-			}
+			std::cout << "ERROR: an out-of-core volume needs a cache directory" << std::endl;
+			return -1;
 		}
-	}
 
-	// extract the zero iso-surface using marching cubes
-	SimpleMesh mesh;
-	for (unsigned int x = 0; x < vol.getDimX() - 1; x++)
-	{
-		std::cerr << "Marching Cubes on slice " << x << " of " << vol.getDimX() << std::endl;
+		// a cached volume of the same surface (type, arguments and input points) and grid skips the construction of the
+		// surface and the sampling
+		BlobCache cache(cacheDirectory);
+		uint64_t volumeKey = HashValue(mc_res, surfaceFactory.key);
+		volumeKey = HashBytes(volMin.data(), sizeof(Vector3d), volumeKey);
+		volumeKey = HashBytes(volMax.data(), sizeof(Vector3d), volumeKey);
+		volumeKey = HashValue(narrowBand, volumeKey);
+		volumeKey = HashString(typeid(SampledVolume).name(), volumeKey);
+		volumeKey = HashValue(quantizationScale, HashValue(quantizationOffset, volumeKey));
+		volumeKey = HashValue(volumeLayout, volumeKey);
 
-		for (unsigned int y = 0; y < vol.getDimY() - 1; y++)
+		// an out-of-core volume is used in place: its blob only gets a valid header when it is completely sampled
+		SampledVolume vol(volMin, volMax, mc_res, mc_res, mc_res, 1, volumeLayout,
+			outOfCore ? cache.GetPath("volume", volumeKey) : std::string(), BlobCache::GetHeaderSize());
+		if (outOfCore && !vol.isMapped())
 		{
-			for (unsigned int z = 0; z < vol.getDimZ() - 1; z++)
+			std::cout << "ERROR: unable to map " << cache.GetPath("volume", volumeKey) << std::endl;
+			return -1;
+		}
+		vol.setQuantization(quantizationScale, quantizationOffset);
+
+		const size_t numVoxels = (size_t)vol.getDimX() * vol.getDimY() * vol.getDimZ();
+		const bool cached = !cacheDirectory.empty() && (outOfCore ?
+			cache.Contains<SampledVolume::StorageType>("volume", volumeKey, vol.getDataSize()) :
+			cache.Load("volume", volumeKey, vol.getData(), vol.getDataSize()));
+		if (cached)
+		{
+			std::cerr << (outOfCore ? "Mapped" : "Loaded") << " the sampled volume from " << cache.GetPath("volume", volumeKey) << std::endl;
+		}
+		else
+		{
+			ImplicitSurface* surface = surfaceFactory.create();
+			if (narrowBand)
+				std::cerr << "Narrow band: " << SampleVolumeNarrowBand(surface, vol, 0.00f) << " of " << numVoxels << " voxels evaluated" << std::endl;
+			else
+				SampleVolume(surface, vol);
+
+			if (!cacheDirectory.empty())
 			{
-				ProcessVolumeCell(&vol, x, y, z, 0.00f, &mesh);
+				if (!outOfCore)
+					cache.Store("volume", volumeKey, vol.getData(), vol.getDataSize());
+				else if (vol.flush())
+					cache.Commit<SampledVolume::StorageType>("volume", volumeKey, vol.getDataSize());
 			}
+			delete surface;
+		}
+
+		// a level > 0 extracts a coarse preview from the mip pyramid of the volume, at 1 / 2^level of the resolution
+		unsigned int previewLevel = 0;
+		if (previewLevel > 0)
+			vol.buildPyramid(previewLevel);
+		SampledVolume* extractionVolume = vol.getLevel(previewLevel);
+
+		// extract the zero iso-surface using marching cubes, or surface nets (one vertex per cell, well-shaped triangles;
+		// pass the surface as well for dual contouring, which keeps sharp features but evaluates its gradients)
+		bool surfaceNets = false;
+		if (surfaceNets)
+		{
+			ExtractSurfaceNets(extractionVolume, 0.00f, &mesh);
+		}
+		else
+		{
+			ExtractIsoSurfaceParallel(extractionVolume, 0.00f, &mesh, [](size_t done, size_t total) {
+				std::cerr << "\rMarching Cubes: " << done << " of " << total << " slabs" << (done == total ? "\n" : "") << std::flush;
+			});
 		}
 	}
 
@@ -56,8 +160,6 @@ int main()
 		return -1;
 	}
 
-	delete surface;
-
 	std::cin.get();
 	return 0;
 }